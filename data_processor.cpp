@@ -10,231 +10,3577 @@
 #include "mqtt/client.h"
 #include <boost/asio.hpp>
 #include <map>
+#include <iterator>
+#include <unordered_map>
+#include <set>
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstring>
+#include <cmath>
+#include <memory>
+#include <string_view>
+#include <shared_mutex>
+#include <charconv>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <array>
 
 #define QOS 1
 #define BROKER_ADDRESS "tcp://localhost:1883"
 #define GRAPHITE_HOST "127.0.0.1"
 #define GRAPHITE_PORT 2003
+#define GRAPHITE_PICKLE_PORT 2004
+#define GRAPHITE_QUEUE_CAPACITY 65536 // métricas pendentes antes de descartar
+#define GRAPHITE_MAX_BATCH 500        // métricas por escrita no socket
+#define GRAPHITE_MAX_LINGER_MS 50     // espera máxima para completar um lote
+#define GRAPHITE_RECONNECT_MIN_MS 100
+#define GRAPHITE_RECONNECT_MAX_MS 10000
+#define WAL_SEGMENT_BYTES (64ull << 20)
+#define WAL_CATCHUP_RATE 20000 // métricas/s ao reenviar o atraso acumulado
+#define WAL_SYNC_MS 1000       // intervalo entre fdatasync do segmento ativo e do ack
+#define WAL_FLUSH_BYTES (1 << 20)
+#define WAL_RETRY_MS 1000      // espera após uma falha de escrita ou leitura do WAL
+#define HISTORY_WINDOW 1000 // leituras mantidas por sensor para a detecção de outliers
+#define WORKER_COUNT 4
+#define WORKER_QUEUE_CAPACITY 4096 // potência de 2
+#define SERIES_SHARDS 64          // potência de 2
+#define INACTIVITY_PERIODS 10     // períodos sem dados até o alarme de inatividade
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_BITS 8 // 256 slots de 1 ms por nível
+#define STATS_INTERVAL_MS 10000
+#define PROCESSOR_NAME "data_processor" // prefixo das métricas <nome>.self.*
+#define SUBSCRIPTION_BATCH 64        // filtros por pacote SUBSCRIBE/UNSUBSCRIBE
+#define SUBSCRIPTION_FLUSH_MS 50
+#define SUBSCRIPTION_RETRY_MS 1000   // espera após uma falha de SUBSCRIBE/UNSUBSCRIBE
+#define MACHINE_EXPIRY_MS 600000     // máquina sem leituras por esse tempo é esquecida; 0 = nunca
+#define MACHINE_EXPIRY_CHECK_MS 10000
+#define SNAPSHOT_INTERVAL_MS 30000
+#define SNAPSHOT_MAGIC 0x50414E53u // "SNAP"
+#define SNAPSHOT_VERSION 2
+#define CLUSTER_VIRTUAL_NODES 128      // pontos de cada instância no anel de hash
+#define CLUSTER_HEARTBEAT_MS 1000
+#define CLUSTER_MEMBER_TIMEOUT_MS 3500 // sem heartbeat por esse tempo, o membro sai do anel
 
 namespace asio = boost::asio;
 using asio::ip::tcp;
 
-struct SensorInfo
+// Janela circular de tamanho fixo com média e variância deslizantes (Welford),
+// de modo que inserir uma leitura e calcular o z-score custa O(1).
+class SensorWindow
 {
-    std::string id;
-    int interval;
-    SensorInfo(std::string id, int interval)
-        : id(id), interval(interval) {}
+public:
+    void push(float value)
+    {
+        if (values.empty())
+        {
+            values.resize(history_window);
+        }
+
+        if (count < values.size())
+        {
+            values[next] = value;
+            count++;
+            double delta = value - mean;
+            mean += delta / count;
+            m2 += delta * (value - mean);
+        }
+        else
+        {
+            float oldest = values[next];
+            values[next] = value;
+            double old_mean = mean;
+            double delta = static_cast<double>(value) - oldest;
+            mean += delta / count;
+            m2 += delta * (value - mean + oldest - old_mean);
+            if (m2 < 0)
+            {
+                m2 = 0;
+            }
+        }
+        next = (next + 1) % values.size();
+    }
+
+    size_t size() const { return count; }
+    double get_mean() const { return mean; }
+    double get_stddev() const { return count ? std::sqrt(m2 / count) : 0.0; }
+
+    // Acrescenta a `out` o buffer circular como está, em um único memcpy;
+    // retorna a posição do valor mais antigo dentro do trecho acrescentado.
+    size_t append_raw(std::vector<float> &out) const
+    {
+        out.insert(out.end(), values.begin(), values.begin() + count);
+        return count < values.size() ? 0 : next;
+    }
+
+    static size_t history_window;
+
+private:
+    std::vector<float> values;
+    size_t next = 0;
+    size_t count = 0;
+    double mean = 0;
+    double m2 = 0;
+};
+
+size_t SensorWindow::history_window = HISTORY_WINDOW;
+
+// CRC-32 (IEEE, polinômio refletido 0xEDB88320) dos arquivos em disco.
+uint32_t crc32(const uint8_t *data, size_t size)
+{
+    static const auto table = []
+    {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+            {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; i++)
+    {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+uint64_t hash_name(std::string_view name)
+{
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+    for (unsigned char c : name)
+    {
+        hash = (hash ^ c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Converte nomes de máquinas e sensores em ids inteiros estáveis. A busca de
+// um nome já conhecido é feita direto sobre o string_view, sem alocação.
+class NameTable
+{
+public:
+    uint32_t intern(std::string_view name)
+    {
+        uint64_t hash = hash_name(name);
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            uint32_t id = find(name, hash);
+            if (id != UINT32_MAX)
+            {
+                return id;
+            }
+        }
+
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        uint32_t id = find(name, hash);
+        if (id != UINT32_MAX)
+        {
+            return id;
+        }
+        if ((names.size() + 1) * 4 > slots.size() * 3)
+        {
+            grow();
+        }
+        id = static_cast<uint32_t>(names.size());
+        names.emplace_back(name);
+        insert(id, hash);
+        return id;
+    }
+
+    const std::string &name(uint32_t id) const
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return names[id]; // std::deque mantém as referências estáveis
+    }
+
+private:
+    uint32_t find(std::string_view name, uint64_t hash) const
+    {
+        if (slots.empty())
+        {
+            return UINT32_MAX;
+        }
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash & mask;; i = (i + 1) & mask)
+        {
+            uint32_t slot = slots[i];
+            if (slot == 0)
+            {
+                return UINT32_MAX;
+            }
+            if (names[slot - 1] == name)
+            {
+                return slot - 1;
+            }
+        }
+    }
+
+    void insert(uint32_t id, uint64_t hash)
+    {
+        size_t mask = slots.size() - 1;
+        size_t i = hash & mask;
+        while (slots[i] != 0)
+        {
+            i = (i + 1) & mask;
+        }
+        slots[i] = id + 1;
+    }
+
+    void grow()
+    {
+        slots.assign(slots.empty() ? 64 : slots.size() * 2, 0);
+        for (uint32_t id = 0; id < names.size(); id++)
+        {
+            insert(id, hash_name(names[id]));
+        }
+    }
+
+    mutable std::shared_mutex mutex;
+    std::deque<std::string> names;
+    std::vector<uint32_t> slots; // id + 1; 0 = vazio
+};
+
+NameTable machine_names;
+NameTable sensor_names;
+
+int64_t monotonic_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t monotonic_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t epoch_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+uint64_t series_key(uint32_t machine, uint32_t sensor)
+{
+    return (static_cast<uint64_t>(machine) << 32) | sensor;
+}
+
+// Janela de 64 números de sequência por série. O bit i de `seen` indica se
+// `highest - i` já chegou. Um buraco conta como perda ao ser aberto e deixa de
+// contar se a leitura chegar depois (reordenação); repetições dentro da janela
+// são descartadas. seq == 1 marca o reinício do monitor.
+struct SequenceWindow
+{
+    enum Verdict
+    {
+        accepted,
+        duplicate
+    };
+
+    uint64_t run = 0;     // execução do monitor (horário de início, em ms) a que a janela se refere
+    uint64_t base = 0;    // primeiro número visto nesta execução; abaixo dele nada foi contado como perdido
+    uint64_t highest = 0;
+    uint64_t seen = 0;
+    uint64_t received = 0;
+    uint64_t lost = 0;
+    uint64_t duplicates = 0;
+    uint64_t reordered = 0;
+    uint64_t restarts = 0;
+
+    Verdict track(uint64_t reading_run, uint64_t seq)
+    {
+        if (seq == 0)
+        {
+            return accepted; // monitor sem números de sequência
+        }
+        if (highest == 0 || reading_run > run)
+        {
+            // nova execução do monitor: a numeração recomeça
+            restarts += highest != 0;
+            run = reading_run;
+            base = highest = seq;
+            seen = 1;
+            received++;
+            return accepted;
+        }
+        if (reading_run < run)
+        {
+            // de uma execução anterior (ex.: esvaziada do spool após o reinício);
+            // não há mais janela para deduplicá-la
+            reordered++;
+            return accepted;
+        }
+        if (seq > highest)
+        {
+            uint64_t distance = seq - highest;
+            lost += distance - 1;
+            seen = distance >= 64 ? 1 : (seen << distance) | 1;
+            highest = seq;
+            received++;
+            return accepted;
+        }
+
+        uint64_t distance = highest - seq;
+        if (distance >= 64)
+        {
+            // atrasada demais para a janela: já foi contada como perdida
+            received++;
+            reordered++;
+            lost -= lost > 0 && seq > base;
+            return accepted;
+        }
+        uint64_t bit = uint64_t(1) << distance;
+        if (seen & bit)
+        {
+            duplicates++;
+            return duplicate;
+        }
+        seen |= bit;
+        received++;
+        reordered++;
+        lost -= lost > 0 && seq > base;
+        return accepted;
+    }
+};
+
+struct SeriesState
+{
+    uint32_t machine = 0;
+    uint32_t sensor = 0;
+    int interval_ms = 0;          // data_interval anunciado; 0 = ainda desconhecido
+    int heartbeat_ms = 0;         // heartbeat_interval anunciado por sensores com banda morta
+    int64_t last_activity_ms = 0; // monotonic_ms() da última leitura
+    int64_t last_sample_ms = 0;   // timestamp da última leitura, em ms desde a época
+    bool timer_armed = false;
+    SensorWindow window;
+    SequenceWindow sequence;
+    uint64_t reported_received = 0; // contadores já publicados por report_sequence_stats()
+    uint64_t reported_lost = 0;
+    uint64_t reported_duplicates = 0;
+};
+
+// Estado por (máquina, sensor) em tabelas de endereçamento aberto divididas em
+// SERIES_SHARDS partes, cada uma com seu próprio lock. A chave é o par de ids
+// internados, então nenhuma string é montada por mensagem.
+class SeriesRegistry
+{
+public:
+    // Executa f(SeriesState &) com o lock da partição, criando a série se preciso.
+    template <typename F>
+    void with_series(uint32_t machine, uint32_t sensor, F &&f)
+    {
+        uint64_t key = ::series_key(machine, sensor);
+        Shard &shard = shards[shard_of(key)];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        Slot &slot = find_or_insert(shard, key);
+        if (!slot.used)
+        {
+            slot.used = true;
+            slot.key = key;
+            slot.state.machine = machine;
+            slot.state.sensor = sensor;
+            shard.count++;
+        }
+        f(slot.state);
+    }
+
+    // Como with_series, mas sem criar a série; retorna false se ela não existe.
+    template <typename F>
+    bool visit(uint32_t machine, uint32_t sensor, F &&f)
+    {
+        uint64_t key = ::series_key(machine, sensor);
+        Shard &shard = shards[shard_of(key)];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.slots.empty())
+        {
+            return false;
+        }
+        Slot &slot = probe(shard.slots, key);
+        if (!slot.used)
+        {
+            return false;
+        }
+        f(slot.state);
+        return true;
+    }
+
+    // Remove todas as séries da máquina; retorna quantas foram removidas.
+    size_t erase_machine(uint32_t machine)
+    {
+        size_t erased = 0;
+        for (auto &shard : shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (size_t i = 0; i < shard.slots.size();)
+            {
+                // o deslocamento pode trazer outra série da máquina para i
+                if (shard.slots[i].used && shard.slots[i].state.machine == machine)
+                {
+                    erase_slot(shard, i);
+                    erased++;
+                }
+                else
+                {
+                    i++;
+                }
+            }
+        }
+        return erased;
+    }
+
+    // Visita todas as séries, travando uma partição por vez.
+    template <typename F>
+    void for_each(F &&f)
+    {
+        for (auto &shard : shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (auto &slot : shard.slots)
+            {
+                if (slot.used)
+                {
+                    f(slot.state);
+                }
+            }
+        }
+    }
+
+private:
+    struct Slot
+    {
+        bool used = false;
+        uint64_t key = 0;
+        SeriesState state;
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::vector<Slot> slots;
+        size_t count = 0;
+    };
+
+    static uint64_t mix(uint64_t key)
+    {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        return key;
+    }
+
+    static size_t shard_of(uint64_t key)
+    {
+        return mix(key) & (SERIES_SHARDS - 1);
+    }
+
+    static Slot &probe(std::vector<Slot> &slots, uint64_t key)
+    {
+        size_t mask = slots.size() - 1;
+        for (size_t i = (mix(key) >> 8) & mask;; i = (i + 1) & mask)
+        {
+            if (!slots[i].used || slots[i].key == key)
+            {
+                return slots[i];
+            }
+        }
+    }
+
+    // Remoção com deslocamento para trás: puxa para o buraco as entradas seguintes
+    // do mesmo cluster cuja posição ideal não fica entre o buraco e elas, de modo
+    // que a sondagem linear continua achando tudo sem lápides.
+    static void erase_slot(Shard &shard, size_t hole)
+    {
+        std::vector<Slot> &slots = shard.slots;
+        size_t mask = slots.size() - 1;
+        for (size_t j = (hole + 1) & mask; slots[j].used; j = (j + 1) & mask)
+        {
+            size_t home = (mix(slots[j].key) >> 8) & mask;
+            // home fora do intervalo circular (hole, j]
+            if (((j - home) & mask) >= ((j - hole) & mask))
+            {
+                slots[hole] = std::move(slots[j]);
+                hole = j;
+            }
+        }
+        slots[hole] = Slot{};
+        shard.count--;
+    }
+
+    Slot &find_or_insert(Shard &shard, uint64_t key)
+    {
+        if ((shard.count + 1) * 4 > shard.slots.size() * 3)
+        {
+            std::vector<Slot> old(shard.slots.empty() ? 16 : shard.slots.size() * 2);
+            old.swap(shard.slots);
+            for (auto &slot : old)
+            {
+                if (slot.used)
+                {
+                    probe(shard.slots, slot.key) = std::move(slot);
+                }
+            }
+        }
+        return probe(shard.slots, key);
+    }
+
+    Shard shards[SERIES_SHARDS];
+};
+
+SeriesRegistry series_registry;
+
+// Codificação das leituras anunciada por cada monitor em "payload_format".
+enum class PayloadFormat : uint8_t
+{
+    unknown,
+    json,
+    cbor,
+    msgpack
+};
+
+PayloadFormat parse_payload_format(const std::string &name)
+{
+    if (name == "cbor")
+        return PayloadFormat::cbor;
+    if (name == "msgpack")
+        return PayloadFormat::msgpack;
+    return PayloadFormat::json;
+}
+
+struct MachineInfo
+{
+    bool announced = false;
+    std::string announcement; // último anúncio, guardado nos snapshots
+    int interval = 0; // menor data_interval entre os sensores
+    PayloadFormat format = PayloadFormat::unknown;
+};
+
+// Máquinas anunciadas em /sensor_monitors, indexadas pelo id internado. Escritas
+// são raras; a contagem atômica permite que o caminho de cada leitura consulte
+// empty() sem lock.
+class MachineRegistry
+{
+public:
+    // Registra ou atualiza o anúncio; retorna true se a máquina é nova.
+    bool announce(uint32_t machine, int interval, PayloadFormat format, std::string announcement)
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        if (machines.size() <= machine)
+        {
+            machines.resize(machine + 1);
+        }
+        MachineInfo &info = machines[machine];
+        bool is_new = !info.announced;
+        info.announced = true;
+        info.interval = interval;
+        info.format = format;
+        info.announcement = std::move(announcement);
+        if (is_new)
+        {
+            count++;
+        }
+        return is_new;
+    }
+
+    // Esquece uma máquina expirada; um novo anúncio a registra de novo.
+    void forget(uint32_t machine)
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        if (machine < machines.size() && machines[machine].announced)
+        {
+            machines[machine] = MachineInfo{};
+            count--;
+        }
+    }
+
+    bool empty() const { return count == 0; }
+
+    std::vector<std::pair<uint32_t, std::string>> announcements() const
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        std::vector<std::pair<uint32_t, std::string>> result;
+        for (uint32_t machine = 0; machine < machines.size(); machine++)
+        {
+            if (machines[machine].announced)
+            {
+                result.emplace_back(machine, machines[machine].announcement);
+            }
+        }
+        return result;
+    }
+
+    PayloadFormat format_of(uint32_t machine) const
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return machine < machines.size() ? machines[machine].format : PayloadFormat::unknown;
+    }
+
+private:
+    mutable std::shared_mutex mutex;
+    std::vector<MachineInfo> machines;
+    std::atomic<size_t> count{0};
+};
+
+MachineRegistry machine_registry;
+
+// Timing wheel hierárquica com resolução de 1 ms. Cada nível tem 2^TIMER_WHEEL_BITS
+// slots; entradas de níveis superiores descem em cascata conforme o tempo avança.
+// Inserir custa O(1) e a thread só acorda quando há slot a processar, então o
+// custo acompanha o número de expirações e não o número de séries.
+class TimerWheel
+{
+public:
+    using Callback = void (*)(uint64_t key);
+
+    TimerWheel() : current(monotonic_ms()) {}
+
+    void start(Callback callback)
+    {
+        on_expire = callback;
+        thread = std::thread(&TimerWheel::run, this);
+    }
+
+    void schedule(uint64_t key, int64_t deadline_ms)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        insert(Entry{key, deadline_ms});
+        count++;
+        if (deadline_ms < wake_at)
+        {
+            cv.notify_one();
+        }
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return count;
+    }
+
+    std::atomic<uint64_t> expired{0};
+
+private:
+    struct Entry
+    {
+        uint64_t key;
+        int64_t deadline;
+    };
+
+    static constexpr int64_t SLOTS = 1 << TIMER_WHEEL_BITS;
+    static constexpr int64_t MASK = SLOTS - 1;
+
+    void insert(const Entry &entry)
+    {
+        int64_t tick = std::max(entry.deadline, current + 1);
+        int64_t delta = tick - current;
+        int level = 0;
+        while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (int64_t(1) << (TIMER_WHEEL_BITS * (level + 1))))
+        {
+            level++;
+        }
+        if (level == TIMER_WHEEL_LEVELS - 1)
+        {
+            // além do alcance da roda: fica no último nível e é reavaliado na cascata
+            tick = std::min(tick, current + (int64_t(1) << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1);
+        }
+        slots[level][(tick >> (TIMER_WHEEL_BITS * level)) & MASK].push_back(entry);
+    }
+
+    void cascade(int level)
+    {
+        size_t index = (current >> (TIMER_WHEEL_BITS * level)) & MASK;
+        if (index == 0 && level + 1 < TIMER_WHEEL_LEVELS)
+        {
+            cascade(level + 1);
+        }
+        std::vector<Entry> entries;
+        entries.swap(slots[level][index]);
+        for (const auto &entry : entries)
+        {
+            insert(entry);
+        }
+    }
+
+    int64_t next_wakeup() const
+    {
+        if (count == 0)
+        {
+            return current + STATS_INTERVAL_MS;
+        }
+        int64_t boundary = current | MASK;
+        for (int64_t tick = current + 1; tick <= boundary; tick++)
+        {
+            if (!slots[0][tick & MASK].empty())
+            {
+                return tick;
+            }
+        }
+        return boundary + 1; // próxima cascata
+    }
+
+    void run()
+    {
+        std::vector<Entry> due;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            int64_t now = monotonic_ms();
+            while (current < now && due.empty())
+            {
+                if (count == 0)
+                {
+                    current = now;
+                    break;
+                }
+                current++;
+                if ((current & MASK) == 0)
+                {
+                    cascade(1);
+                }
+                due.swap(slots[0][current & MASK]);
+                count -= due.size();
+            }
+
+            if (!due.empty())
+            {
+                lock.unlock();
+                for (const auto &entry : due)
+                {
+                    on_expire(entry.key);
+                }
+                expired += due.size();
+                due.clear();
+                lock.lock();
+                continue;
+            }
+
+            wake_at = next_wakeup();
+            cv.wait_for(lock, std::chrono::milliseconds(wake_at - now));
+            wake_at = INT64_MAX;
+        }
+    }
+
+    std::vector<Entry> slots[TIMER_WHEEL_LEVELS][SLOTS];
+    int64_t current;
+    size_t count = 0;
+    int64_t wake_at = INT64_MAX;
+    Callback on_expire = nullptr;
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    std::thread thread;
+};
+
+TimerWheel inactivity_timers;
+
+// Sensores com banda morta podem ficar calados até um heartbeat inteiro; o prazo
+// tolera dois heartbeats perdidos antes de alarmar.
+int64_t inactivity_period(const SeriesState &series)
+{
+    return std::max(int64_t(INACTIVITY_PERIODS) * series.interval_ms, int64_t(2) * series.heartbeat_ms);
+}
+
+int64_t inactivity_deadline(const SeriesState &series)
+{
+    return series.last_activity_ms + inactivity_period(series);
+}
+
+// Chamado com o lock da série. Uma nova leitura só atualiza last_activity_ms; o
+// timer já armado é reavaliado ao expirar e reagendado para o prazo real.
+void arm_inactivity_timer(SeriesState &series)
+{
+    if (!series.timer_armed && series.interval_ms > 0)
+    {
+        series.timer_armed = true;
+        inactivity_timers.schedule(series_key(series.machine, series.sensor), inactivity_deadline(series));
+    }
+}
+
+// Dias desde 1970-01-01 no calendário gregoriano proléptico (days_from_civil,
+// de Howard Hinnant), sem consultar fuso horário nem tomar locks da libc.
+int64_t days_from_civil(int64_t year, unsigned month, unsigned day)
+{
+    year -= month <= 2;
+    const int64_t era = (year >= 0 ? year : year - 399) / 400;
+    const unsigned year_of_era = static_cast<unsigned>(year - era * 400);
+    const unsigned day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const unsigned day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + static_cast<int64_t>(day_of_era) - 719468;
+}
+
+int days_in_month(int year, int month)
+{
+    static const int days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    return month == 2 && leap ? 29 : days[month - 1];
+}
+
+bool scan_digits(std::string_view text, size_t pos, size_t count, int &value)
+{
+    if (pos + count > text.size())
+    {
+        return false;
+    }
+    value = 0;
+    for (size_t i = pos; i < pos + count; i++)
+    {
+        if (text[i] < '0' || text[i] > '9')
+        {
+            return false;
+        }
+        value = value * 10 + (text[i] - '0');
+    }
+    return true;
+}
+
+// Converte "YYYY-MM-DDTHH:MM:SS[.fração][Z|±HH:MM|±HHMM]" em milissegundos
+// desde a época. Sem sufixo, o horário é tomado como UTC. Não aloca.
+bool parse_iso8601(std::string_view text, int64_t &epoch_ms)
+{
+    int year, month, day, hour, minute, second;
+    if (!scan_digits(text, 0, 4, year) || text.size() < 19 || text[4] != '-' ||
+        !scan_digits(text, 5, 2, month) || text[7] != '-' ||
+        !scan_digits(text, 8, 2, day) || (text[10] != 'T' && text[10] != ' ') ||
+        !scan_digits(text, 11, 2, hour) || text[13] != ':' ||
+        !scan_digits(text, 14, 2, minute) || text[16] != ':' ||
+        !scan_digits(text, 17, 2, second))
+    {
+        return false;
+    }
+    if (month < 1 || month > 12 || day < 1 || day > days_in_month(year, month) ||
+        hour > 23 || minute > 59 || second > 60)
+    {
+        return false;
+    }
+
+    size_t pos = 19;
+    int millis = 0;
+    if (pos < text.size() && (text[pos] == '.' || text[pos] == ','))
+    {
+        pos++;
+        size_t digits = 0;
+        while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9')
+        {
+            if (digits < 3)
+            {
+                millis = millis * 10 + (text[pos] - '0');
+            }
+            digits++;
+            pos++;
+        }
+        if (digits == 0)
+        {
+            return false;
+        }
+        for (; digits < 3; digits++)
+        {
+            millis *= 10;
+        }
+    }
+
+    int offset_minutes = 0;
+    if (pos < text.size() && (text[pos] == 'Z' || text[pos] == 'z'))
+    {
+        pos++;
+    }
+    else if (pos < text.size() && (text[pos] == '+' || text[pos] == '-'))
+    {
+        int sign = text[pos] == '-' ? -1 : 1;
+        int offset_hours, offset_mins;
+        size_t minutes_at = text.size() > pos + 3 && text[pos + 3] == ':' ? pos + 4 : pos + 3;
+        if (!scan_digits(text, pos + 1, 2, offset_hours) || !scan_digits(text, minutes_at, 2, offset_mins))
+        {
+            return false;
+        }
+        offset_minutes = sign * (offset_hours * 60 + offset_mins);
+        pos = minutes_at + 2;
+    }
+    if (pos != text.size())
+    {
+        return false;
+    }
+
+    int64_t seconds = days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second - offset_minutes * 60;
+    epoch_ms = seconds * 1000 + millis;
+    return true;
+}
+
+// Milissegundos desde a época do timestamp da leitura; se ele for inválido,
+// usa o horário de recebimento.
+int64_t timestamp2UNIX(std::string_view timestamp)
+{
+    int64_t epoch_ms;
+    if (!parse_iso8601(timestamp, epoch_ms))
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+    return epoch_ms;
+}
+
+bool is_outlier(float value, const SensorWindow &window)
+{
+    if (window.size() < 2)
+        return false;
+
+    double stddev = window.get_stddev();
+    if (stddev <= 0)
+        return false;
+
+    double z_score = (value - window.get_mean()) / stddev;
+    return std::abs(z_score) > 3;
+}
+
+bool owns_machine(std::string_view machine_id);
+void note_announcement(const std::string &machine_id, const nlohmann::json &announcement);
+void subscribe_machine(const std::string &machine_id, const nlohmann::json &announcement);
+void restore_series(const std::string &machine_id);
+void discard_restored_series();
+
+void processInitialMessage(const nlohmann::json &initialMessage)
+{
+    int minDataInterval = std::numeric_limits<int>::max(); // maior valor possível para int
+    const std::string &machine_id = initialMessage["machine_id"].get_ref<const std::string &>();
+    note_announcement(machine_id, initialMessage);
+    if (!owns_machine(machine_id))
+    {
+        // séries e timers vivem só na instância dona da máquina
+        return;
+    }
+    subscribe_machine(machine_id, initialMessage);
+    uint32_t machine = machine_names.intern(machine_id);
+
+    for (const auto &sensor : initialMessage["sensors"])
+    {
+        int dataInterval = sensor["data_interval"];
+        int heartbeatInterval = sensor.value("heartbeat_interval", 0);
+        if (dataInterval < minDataInterval)
+        {
+            minDataInterval = dataInterval;
+        }
+
+        // cada sensor tem seu próprio prazo de inatividade, contado a partir do anúncio
+        uint32_t sensor_id = sensor_names.intern(sensor["sensor_id"].get<std::string>());
+        series_registry.with_series(machine, sensor_id, [&](SeriesState &series)
+                                    {
+                                        if (series.last_activity_ms == 0)
+                                        {
+                                            series.last_activity_ms = monotonic_ms();
+                                        }
+                                        series.interval_ms = std::max(dataInterval, 1);
+                                        series.heartbeat_ms = std::max(heartbeatInterval, 0);
+                                        arm_inactivity_timer(series); });
+    }
+
+    PayloadFormat format = parse_payload_format(initialMessage.value("payload_format", "json"));
+    machine_registry.announce(machine, minDataInterval, format, initialMessage.dump());
+}
+
+// Histograma de latências com buckets logarítmicos no estilo HDR: 16 sub-buckets
+// por potência de 2 (erro relativo abaixo de 6,25%) e contadores atômicos, de
+// modo que qualquer thread registra sem lock.
+class LatencyHistogram
+{
+public:
+    void record(int64_t ns)
+    {
+        counts[bucket_of(ns > 0 ? static_cast<uint64_t>(ns) : 0)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Copia e zera os contadores; devolve o total de amostras do intervalo.
+    uint64_t drain(std::vector<uint64_t> &snapshot)
+    {
+        snapshot.resize(BUCKETS);
+        uint64_t total = 0;
+        for (size_t i = 0; i < BUCKETS; i++)
+        {
+            snapshot[i] = counts[i].exchange(0, std::memory_order_relaxed);
+            total += snapshot[i];
+        }
+        return total;
+    }
+
+    static uint64_t percentile(const std::vector<uint64_t> &snapshot, uint64_t total, double quantile)
+    {
+        uint64_t rank = static_cast<uint64_t>(std::ceil(quantile * total));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < snapshot.size(); i++)
+        {
+            seen += snapshot[i];
+            if (seen >= rank && snapshot[i] > 0)
+            {
+                return bucket_value(i);
+            }
+        }
+        return 0;
+    }
+
+private:
+    static constexpr int SUB_BITS = 4;
+    static constexpr uint64_t SUB_BUCKETS = 1 << SUB_BITS;
+    static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    static size_t bucket_of(uint64_t value)
+    {
+        if (value < SUB_BUCKETS)
+        {
+            return value;
+        }
+        int exponent = 63 - __builtin_clzll(value);
+        return (exponent - SUB_BITS + 1) * SUB_BUCKETS + ((value >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1));
+    }
+
+    // ponto médio do bucket
+    static uint64_t bucket_value(size_t bucket)
+    {
+        if (bucket < SUB_BUCKETS)
+        {
+            return bucket;
+        }
+        int exponent = static_cast<int>(bucket / SUB_BUCKETS) + SUB_BITS - 1;
+        uint64_t width = uint64_t(1) << (exponent - SUB_BITS);
+        return (SUB_BUCKETS + bucket % SUB_BUCKETS) * width + width / 2;
+    }
+
+    std::atomic<uint64_t> counts[BUCKETS] = {};
+};
+
+// Estágios medidos entre a amostra no monitor e a escrita no Graphite.
+enum LatencyStage
+{
+    STAGE_RECEIVE, // envio no monitor (sent_ns) -> chegada no callback MQTT
+    STAGE_QUEUE,   // callback -> worker retirar da fila
+    STAGE_PARSE,   // decodificação do payload
+    STAGE_FLUSH,   // post_metric -> escrita confirmada no socket do Graphite
+    STAGE_COUNT
+};
+
+const char *latency_stage_names[STAGE_COUNT] = {"receive", "queue", "parse", "flush"};
+LatencyHistogram stage_latency[STAGE_COUNT];
+
+enum class GraphiteProtocol
+{
+    plaintext,
+    pickle
+};
+
+struct GraphiteOptions
+{
+    std::string host = GRAPHITE_HOST;
+    int port = GRAPHITE_PORT;
+    GraphiteProtocol protocol = GraphiteProtocol::plaintext;
+    size_t queue_capacity = GRAPHITE_QUEUE_CAPACITY;
+    size_t max_batch = GRAPHITE_MAX_BATCH;
+    int max_linger_ms = GRAPHITE_MAX_LINGER_MS;
+    std::string wal_dir; // vazio: fila só em memória, descartando quando cheia
+    uint64_t wal_segment_bytes = WAL_SEGMENT_BYTES;
+    double wal_catchup_rate = WAL_CATCHUP_RATE;
+};
+
+struct Metric
+{
+    std::string path;
+    std::time_t timestamp;
+    double value;
+    int64_t queued_ns = 0; // monotonic_ns() ao entrar na fila
+};
+
+void encode_plaintext(const std::vector<Metric> &metrics, std::string &out)
+{
+    for (const auto &metric : metrics)
+    {
+        char number[64];
+        out += metric.path;
+        out += ' ';
+        out.append(number, std::to_chars(number, number + sizeof(number), metric.value, std::chars_format::fixed, 6).ptr);
+        out += ' ';
+        out.append(number, std::to_chars(number, number + sizeof(number), static_cast<long long>(metric.timestamp)).ptr);
+        out += '\n';
+    }
+}
+
+// Codifica [(path, (timestamp, value)), ...] no protocolo pickle 2, precedido
+// pelo tamanho em 4 bytes big-endian, como espera o receptor pickle do carbon.
+void encode_pickle(const std::vector<Metric> &metrics, std::string &out)
+{
+    auto put_le32 = [&out](uint32_t v)
+    {
+        for (int i = 0; i < 4; i++)
+            out += static_cast<char>((v >> (8 * i)) & 0xff);
+    };
+
+    size_t header = out.size();
+    out.append(4, '\0');
+    out += "\x80\x02]("; // PROTO 2, EMPTY_LIST, MARK
+    for (const auto &metric : metrics)
+    {
+        out += 'X'; // BINUNICODE
+        put_le32(static_cast<uint32_t>(metric.path.size()));
+        out += metric.path;
+
+        long long timestamp = metric.timestamp;
+        if (timestamp >= INT32_MIN && timestamp <= INT32_MAX)
+        {
+            out += 'J'; // BININT
+            put_le32(static_cast<uint32_t>(timestamp));
+        }
+        else
+        {
+            out += "\x8a\x08"; // LONG1, 8 bytes
+            for (int i = 0; i < 8; i++)
+                out += static_cast<char>((static_cast<unsigned long long>(timestamp) >> (8 * i)) & 0xff);
+        }
+
+        uint64_t bits;
+        std::memcpy(&bits, &metric.value, sizeof(bits));
+        out += 'G'; // BINFLOAT, big-endian
+        for (int i = 7; i >= 0; i--)
+            out += static_cast<char>((bits >> (8 * i)) & 0xff);
+
+        out += "\x86\x86"; // TUPLE2 (timestamp, value), TUPLE2 (path, ...)
+    }
+    out += "e."; // APPENDS, STOP
+
+    uint32_t length = static_cast<uint32_t>(out.size() - header - 4);
+    for (int i = 0; i < 4; i++)
+        out[header + i] = static_cast<char>((length >> (8 * (3 - i))) & 0xff);
+}
+
+// Write-ahead log das métricas destinadas ao Graphite. Cada métrica vira um
+// registro [u32 tamanho][u32 CRC-32][i64 enfileirada em (ns desde a época)]
+// [i64 timestamp][f64 valor][path] acrescentado ao segmento ativo
+// <dir>/<offset inicial>.wal; ao passar de segment_bytes abre-se um novo. Os
+// offsets são lógicos e contínuos entre segmentos. O envio lê a partir do
+// cursor e, depois de cada escrita bem-sucedida no socket, grava o offset
+// confirmado em <dir>/ack; segmentos inteiramente abaixo dele são apagados.
+// Só a thread do GraphiteWriter usa esta classe.
+class MetricWal
+{
+public:
+    ~MetricWal()
+    {
+        if (active_fd >= 0)
+            close(active_fd);
+        if (ack_fd >= 0)
+            close(ack_fd);
+    }
+
+    static void encode(const Metric &metric, int64_t queued_epoch_ns, std::string &out)
+    {
+        size_t start = out.size();
+        uint32_t body = static_cast<uint32_t>(3 * sizeof(int64_t) + metric.path.size());
+        out.append(RECORD_HEADER, '\0');
+        int64_t timestamp = metric.timestamp;
+        out.append(reinterpret_cast<const char *>(&queued_epoch_ns), sizeof(queued_epoch_ns));
+        out.append(reinterpret_cast<const char *>(&timestamp), sizeof(timestamp));
+        out.append(reinterpret_cast<const char *>(&metric.value), sizeof(metric.value));
+        out += metric.path;
+        uint32_t crc = crc32(reinterpret_cast<const uint8_t *>(out.data() + start + RECORD_HEADER), body);
+        std::memcpy(&out[start], &body, 4);
+        std::memcpy(&out[start + 4], &crc, 4);
+    }
+
+    bool open(const std::string &directory, uint64_t segment_limit)
+    {
+        dir = directory;
+        segment_bytes = segment_limit;
+        mkdir(dir.c_str(), 0755);
+        DIR *handle = opendir(dir.c_str());
+        if (handle == nullptr)
+        {
+            return false;
+        }
+        while (dirent *entry = readdir(handle))
+        {
+            std::string_view name(entry->d_name);
+            uint64_t start;
+            auto [end, error] = std::from_chars(name.data(), name.data() + name.size(), start);
+            if (error == std::errc() && std::string_view(end) == ".wal")
+            {
+                segments.push_back(Segment{start, 0});
+            }
+        }
+        closedir(handle);
+        std::sort(segments.begin(), segments.end(), [](const Segment &a, const Segment &b)
+                  { return a.start < b.start; });
+
+        for (auto &segment : segments)
+        {
+            struct stat st;
+            segment.size = stat(segment_path(segment.start).c_str(), &st) == 0 ? st.st_size : 0;
+        }
+        if (!segments.empty())
+        {
+            recover_tail(segments.back());
+            append_offset = segments.back().start + segments.back().size;
+        }
+        live_segments = segments.size();
+
+        ack_fd = ::open((dir + "/ack").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (ack_fd < 0)
+        {
+            return false;
+        }
+        uint64_t saved[2];
+        bool have_ack = pread(ack_fd, saved, sizeof(saved), 0) == sizeof(saved) && saved[1] == ~saved[0];
+        uint64_t last = append_offset;
+        uint64_t first = segments.empty() ? last : segments.front().start;
+        ack_offset = have_ack ? std::clamp(saved[0], first, last) : first;
+        read_offset = ack_offset;
+
+        if (segments.empty() || segments.back().size >= segment_bytes)
+        {
+            return roll();
+        }
+        active_fd = ::open(segment_path(segments.back().start).c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+        return active_fd >= 0;
+    }
+
+    // Acrescenta registros já codificados ao segmento ativo. Em caso de falha
+    // nada é acrescentado e os registros podem ser reenviados depois.
+    bool append(const std::string &records)
+    {
+        if (active_fd < 0 && !roll())
+        {
+            return false;
+        }
+        const char *p = records.data();
+        size_t left = records.size();
+        while (left > 0)
+        {
+            ssize_t n = ::write(active_fd, p, left);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                std::cerr << "WAL write failed: " << std::strerror(errno) << std::endl;
+                // desfaz a escrita parcial, senão os offsets seguintes não batem com o arquivo
+                if (left < records.size() && ftruncate(active_fd, segments.back().size) != 0)
+                {
+                    std::cerr << "WAL truncate failed: " << std::strerror(errno) << std::endl;
+                }
+                return false;
+            }
+            p += n;
+            left -= n;
+        }
+        segments.back().size += records.size();
+        append_offset += records.size();
+        unsynced = true;
+        if (segments.back().size >= segment_bytes)
+        {
+            roll(); // se falhar, o próximo append tenta de novo
+        }
+        return true;
+    }
+
+    // Lê até max métricas a partir do cursor; next_offset recebe o offset logo
+    // após a última lida, a ser confirmado com acknowledge() depois do envio.
+    size_t read(std::vector<Metric> &batch, size_t max, uint64_t &next_offset)
+    {
+        int64_t now_epoch = epoch_ns();
+        int64_t now_monotonic = monotonic_ns();
+        while (batch.size() < max && read_offset < append_offset)
+        {
+            size_t index = segment_of(read_offset);
+            const Segment &segment = segments[index];
+            uint64_t position = read_offset - segment.start;
+            if (position >= segment.size)
+            {
+                read_offset = index + 1 < segments.size() ? segments[index + 1].start : append_offset.load();
+                continue;
+            }
+
+            buffer.resize(std::min<uint64_t>(READ_CHUNK, segment.size - position));
+            int fd = ::open(segment_path(segment.start).c_str(), O_RDONLY | O_CLOEXEC);
+            ssize_t n = fd < 0 ? -1 : pread(fd, &buffer[0], buffer.size(), position);
+            if (fd >= 0)
+                close(fd);
+            if (n < 0)
+            {
+                // pode ser passageiro (ex.: EMFILE); o chamador tenta de novo mais tarde
+                std::cerr << "WAL read failed: " << std::strerror(errno) << std::endl;
+                break;
+            }
+            if (n == 0)
+            {
+                skip_segment(index); // arquivo menor que o registrado
+                continue;
+            }
+
+            size_t offset = 0;
+            while (batch.size() < max && offset + RECORD_HEADER <= static_cast<size_t>(n))
+            {
+                uint32_t body, crc;
+                std::memcpy(&body, &buffer[offset], 4);
+                std::memcpy(&crc, &buffer[offset + 4], 4);
+                if (body < 3 * sizeof(int64_t) || body > READ_CHUNK - RECORD_HEADER)
+                {
+                    skip_segment(index);
+                    break;
+                }
+                if (offset + RECORD_HEADER + body > static_cast<size_t>(n))
+                {
+                    break; // registro continua no próximo bloco
+                }
+                const char *p = &buffer[offset + RECORD_HEADER];
+                if (crc32(reinterpret_cast<const uint8_t *>(p), body) != crc)
+                {
+                    skip_segment(index);
+                    break;
+                }
+                int64_t queued_epoch_ns, timestamp;
+                Metric metric;
+                std::memcpy(&queued_epoch_ns, p, 8);
+                std::memcpy(&timestamp, p + 8, 8);
+                std::memcpy(&metric.value, p + 16, 8);
+                metric.timestamp = static_cast<std::time_t>(timestamp);
+                metric.path.assign(p + 24, body - 24);
+                // converte para o relógio monotônico da medição de latência do flush
+                metric.queued_ns = now_monotonic - (now_epoch - queued_epoch_ns);
+                batch.push_back(std::move(metric));
+                offset += RECORD_HEADER + body;
+                read_offset += RECORD_HEADER + body;
+            }
+            if (offset == 0 && batch.size() < max)
+            {
+                skip_segment(index); // segmento termina no meio de um registro
+            }
+        }
+        next_offset = read_offset;
+        return batch.size();
+    }
+
+    void acknowledge(uint64_t offset)
+    {
+        ack_offset = offset;
+        uint64_t saved[2] = {ack_offset, ~ack_offset};
+        if (pwrite(ack_fd, saved, sizeof(saved), 0) != sizeof(saved))
+        {
+            std::cerr << "WAL ack write failed: " << std::strerror(errno) << std::endl;
+        }
+        unsynced = true;
+        while (segments.size() > 1 && segments[1].start <= ack_offset)
+        {
+            unlink(segment_path(segments.front().start).c_str());
+            segments.pop_front();
+            live_segments = segments.size();
+            truncated++;
+        }
+    }
+
+    void sync()
+    {
+        if (unsynced)
+        {
+            fdatasync(active_fd);
+            fdatasync(ack_fd);
+            unsynced = false;
+        }
+    }
+
+    uint64_t unread() const { return append_offset - read_offset; }
+    uint64_t position() const { return read_offset; }
+    uint64_t end() const { return append_offset; }
+    uint64_t backlog() const { return append_offset - ack_offset; }
+    size_t segment_count() const { return live_segments; }
+
+    std::atomic<uint64_t> truncated{0};
+    std::atomic<uint64_t> corrupted{0};
+
+private:
+    static constexpr size_t RECORD_HEADER = 8;
+    static constexpr size_t READ_CHUNK = 1 << 16;
+
+    struct Segment
+    {
+        uint64_t start;
+        uint64_t size;
+    };
+
+    std::string segment_path(uint64_t start) const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/%020llu.wal", static_cast<unsigned long long>(start));
+        return dir + name;
+    }
+
+    size_t segment_of(uint64_t offset) const
+    {
+        size_t index = 0;
+        while (index + 1 < segments.size() && segments[index + 1].start <= offset)
+        {
+            index++;
+        }
+        return index;
+    }
+
+    void skip_segment(size_t index)
+    {
+        corrupted++;
+        read_offset = index + 1 < segments.size() ? segments[index + 1].start : append_offset.load();
+    }
+
+    bool roll()
+    {
+        if (active_fd >= 0)
+        {
+            fdatasync(active_fd);
+            close(active_fd);
+        }
+        active_fd = ::open(segment_path(append_offset).c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (active_fd < 0)
+        {
+            std::cerr << "WAL segment create failed: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        segments.push_back(Segment{append_offset, 0});
+        live_segments = segments.size();
+        return true;
+    }
+
+    // Corta o último segmento no primeiro registro incompleto ou corrompido,
+    // deixado por uma queda no meio de uma escrita.
+    void recover_tail(Segment &segment)
+    {
+        std::string path = segment_path(segment.start);
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return;
+        }
+        std::string data(segment.size, '\0');
+        ssize_t n = pread(fd, &data[0], data.size(), 0);
+        close(fd);
+        uint64_t valid = 0;
+        while (n > 0 && valid + RECORD_HEADER <= static_cast<uint64_t>(n))
+        {
+            uint32_t body, crc;
+            std::memcpy(&body, &data[valid], 4);
+            std::memcpy(&crc, &data[valid + 4], 4);
+            if (body < 3 * sizeof(int64_t) || valid + RECORD_HEADER + body > static_cast<uint64_t>(n) ||
+                crc32(reinterpret_cast<const uint8_t *>(&data[valid + RECORD_HEADER]), body) != crc)
+            {
+                break;
+            }
+            valid += RECORD_HEADER + body;
+        }
+        if (valid != segment.size)
+        {
+            std::cerr << "WAL: truncating " << path << " from " << segment.size << " to " << valid << " bytes" << std::endl;
+            if (truncate(path.c_str(), valid) == 0)
+            {
+                corrupted++;
+                segment.size = valid;
+            }
+        }
+    }
+
+    std::string dir;
+    uint64_t segment_bytes = WAL_SEGMENT_BYTES;
+    std::deque<Segment> segments;
+    int active_fd = -1;
+    int ack_fd = -1;
+    // append_offset, ack_offset e live_segments também são lidos pelas estatísticas
+    std::atomic<uint64_t> append_offset{0};
+    uint64_t read_offset = 0;
+    std::atomic<uint64_t> ack_offset{0};
+    std::atomic<size_t> live_segments{0};
+    bool unsynced = false;
+    std::string buffer;
+};
+
+// Mantém uma conexão TCP persistente com o Graphite. As métricas são
+// enfileiradas pelo callback MQTT e uma thread de envio agrupa até max_batch
+// métricas (ou o que chegar em max_linger_ms) em uma única escrita, no
+// protocolo plaintext ou pickle, reconectando com backoff exponencial. Com um
+// WAL configurado, enqueue() só acrescenta o registro a um buffer e a thread de
+// envio o grava no log antes de enviar, de modo que uma queda do Graphite não
+// perde nem bloqueia a ingestão: o atraso é reenviado em ordem ao reconectar.
+class GraphiteWriter
+{
+public:
+    GraphiteWriter() : socket(io_service) {}
+
+    ~GraphiteWriter() { stop(); }
+
+    bool start(const GraphiteOptions &graphite_options)
+    {
+        options = graphite_options;
+        wal_enabled = !options.wal_dir.empty();
+        if (wal_enabled && !wal.open(options.wal_dir, options.wal_segment_bytes))
+        {
+            std::cerr << "Error opening WAL " << options.wal_dir << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        // o atraso recuperado do disco é reenviado no ritmo de recuperação
+        catchup_end = wal_enabled ? wal.end() : 0;
+        worker = std::thread(&GraphiteWriter::run, this);
+        return true;
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_one();
+        if (worker.joinable())
+        {
+            worker.join();
+        }
+    }
+
+    bool enqueue(Metric metric)
+    {
+        metric.queued_ns = monotonic_ns();
+        size_t depth;
+        if (wal_enabled)
+        {
+            bool wake;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (wal_pending_count == 0)
+                {
+                    oldest = std::chrono::steady_clock::now();
+                }
+                MetricWal::encode(metric, epoch_ns(), wal_pending);
+                depth = ++wal_pending_count;
+                wake = depth == 1 || depth >= options.max_batch || wal_pending.size() >= WAL_FLUSH_BYTES;
+            }
+            queued++;
+            if (wake)
+            {
+                cv.notify_one();
+            }
+            return true;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (queue.size() >= options.queue_capacity)
+            {
+                dropped++;
+                return false;
+            }
+            if (queue.empty())
+            {
+                oldest = std::chrono::steady_clock::now();
+            }
+            queue.push_back(std::move(metric));
+            depth = queue.size();
+        }
+        queued++;
+        if (depth == 1 || depth >= options.max_batch)
+        {
+            cv.notify_one();
+        }
+        return true;
+    }
+
+    std::atomic<uint64_t> queued{0};
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> reconnects{0};
+
+    // Só para as estatísticas; lidos sem sincronização com a thread de envio.
+    uint64_t wal_backlog() const { return wal_enabled ? wal.backlog() : 0; }
+    size_t wal_segments() const { return wal_enabled ? wal.segment_count() : 0; }
+    uint64_t wal_truncated() const { return wal.truncated; }
+
+private:
+    void run()
+    {
+        std::vector<Metric> batch;
+        std::string payload;
+        uint64_t batch_end = 0;
+        int backoff_ms = GRAPHITE_RECONNECT_MIN_MS;
+        auto next_connect = std::chrono::steady_clock::now();
+
+        while (true)
+        {
+            if (wal_enabled)
+            {
+                flush_pending();
+            }
+
+            if (batch.empty())
+            {
+                bool have_batch = wal_enabled ? next_wal_batch(batch, batch_end) : next_memory_batch(batch);
+                if (!have_batch)
+                {
+                    if (stopping)
+                    {
+                        break;
+                    }
+                    continue;
+                }
+
+                payload.clear();
+                if (options.protocol == GraphiteProtocol::pickle)
+                    encode_pickle(batch, payload);
+                else
+                    encode_plaintext(batch, payload);
+            }
+
+            if (!socket.is_open() && std::chrono::steady_clock::now() < next_connect)
+            {
+                if (stopping)
+                {
+                    break;
+                }
+                // espera o backoff, mas acorda para levar ao WAL o que se acumular
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait_until(lock, std::min(next_connect, std::chrono::steady_clock::now() + std::chrono::milliseconds(WAL_SYNC_MS)), [this]
+                              { return stopping || wal_pending.size() >= WAL_FLUSH_BYTES; });
+                continue;
+            }
+            if (!connect())
+            {
+                next_connect = std::chrono::steady_clock::now() + std::chrono::milliseconds(backoff_ms);
+                backoff_ms = std::min(backoff_ms * 2, GRAPHITE_RECONNECT_MAX_MS);
+                continue;
+            }
+            backoff_ms = GRAPHITE_RECONNECT_MIN_MS;
+
+            boost::system::error_code error;
+            boost::asio::write(socket, boost::asio::buffer(payload), error);
+            if (error)
+            {
+                // o lote é reenviado após reconectar; o Graphite sobrescreve pontos repetidos
+                std::cerr << "Graphite write failed: " << error.message() << std::endl;
+                socket.close(error);
+                continue;
+            }
+
+            if (wal_enabled)
+            {
+                wal.acknowledge(batch_end);
+            }
+            int64_t written_ns = monotonic_ns();
+            for (const auto &metric : batch)
+            {
+                stage_latency[STAGE_FLUSH].record(written_ns - metric.queued_ns);
+            }
+            sent += batch.size();
+            std::cout << "Metrics sent: " << batch.size() << " (" << payload.size() << " bytes)" << std::endl;
+            batch.clear();
+        }
+        if (wal_enabled)
+        {
+            flush_pending();
+            wal.sync();
+        }
+        boost::system::error_code ignored_error;
+        socket.close(ignored_error);
+    }
+
+    // Sem WAL: agrupa até max_batch métricas da fila em memória, esperando no
+    // máximo max_linger_ms pela primeira. Retorna false se parou sem métricas.
+    bool next_memory_batch(std::vector<Metric> &batch)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this]
+                { return stopping || !queue.empty(); });
+        cv.wait_until(lock, oldest + std::chrono::milliseconds(options.max_linger_ms), [this]
+                      { return stopping || queue.size() >= options.max_batch; });
+        if (queue.empty())
+        {
+            return false;
+        }
+        size_t count = std::min(queue.size(), options.max_batch);
+        batch.assign(std::make_move_iterator(queue.begin()), std::make_move_iterator(queue.begin() + count));
+        queue.erase(queue.begin(), queue.begin() + count);
+        oldest = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    // Leva ao segmento ativo os registros acumulados por enqueue() e faz o
+    // fdatasync periódico. Se a escrita falhar (ex.: disco cheio), os registros
+    // ficam em memória e a escrita é refeita a cada WAL_RETRY_MS; acima de
+    // queue_capacity registros, os que chegam são descartados.
+    void flush_pending()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (unwritten.empty())
+            {
+                unwritten.swap(wal_pending);
+                unwritten_count = wal_pending_count;
+            }
+            else if (unwritten_count + wal_pending_count <= options.queue_capacity)
+            {
+                unwritten += wal_pending;
+                unwritten_count += wal_pending_count;
+            }
+            else
+            {
+                dropped += wal_pending_count;
+            }
+            wal_pending.clear();
+            wal_pending_count = 0;
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (!unwritten.empty() && now >= next_append)
+        {
+            if (wal.append(unwritten))
+            {
+                unwritten.clear();
+                unwritten_count = 0;
+            }
+            else
+            {
+                next_append = now + std::chrono::milliseconds(WAL_RETRY_MS);
+            }
+        }
+        if (now >= next_sync)
+        {
+            wal.sync();
+            next_sync = now + std::chrono::milliseconds(WAL_SYNC_MS);
+        }
+    }
+
+    // Com WAL: lê o próximo lote a partir do cursor. Enquanto o cursor está
+    // antes de catchup_end (o fim do WAL quando a conexão voltou), o atraso da
+    // queda é reenviado a no máximo catchup_rate métricas por segundo para não
+    // afogar o carbon; o tráfego gravado depois disso segue sem limite. Retorna
+    // false quando ainda não há lote; run() volta a levar o pendente ao disco e
+    // tenta de novo.
+    bool next_wal_batch(std::vector<Metric> &batch, uint64_t &batch_end)
+    {
+        auto now = std::chrono::steady_clock::now();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (wal.unread() == 0)
+            {
+                // nada no disco: espera chegar algo e deixa o lote se completar
+                cv.wait_for(lock, std::chrono::milliseconds(WAL_SYNC_MS), [this]
+                            { return stopping || wal_pending_count > 0; });
+                cv.wait_until(lock, oldest + std::chrono::milliseconds(options.max_linger_ms), [this]
+                              { return stopping || wal_pending_count >= options.max_batch; });
+                return false;
+            }
+        }
+
+        size_t limit = options.max_batch;
+        bool catching_up = wal.position() < catchup_end;
+        if (catching_up)
+        {
+            double elapsed = std::chrono::duration<double>(now - refill).count();
+            tokens = std::min(tokens + elapsed * options.wal_catchup_rate, static_cast<double>(options.max_batch));
+            refill = now;
+            if (tokens < 1)
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait_for(lock, std::chrono::duration<double>((1 - tokens) / options.wal_catchup_rate), [this]
+                            { return stopping.load(); });
+                return false;
+            }
+            limit = std::min(limit, static_cast<size_t>(tokens));
+        }
+        else
+        {
+            tokens = options.max_batch;
+            refill = now;
+        }
+
+        if (wal.read(batch, limit, batch_end) == 0)
+        {
+            // erro de leitura com registros pendentes: espera em vez de girar
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait_for(lock, std::chrono::milliseconds(WAL_RETRY_MS), [this]
+                        { return stopping.load(); });
+            return false;
+        }
+        if (catching_up)
+        {
+            tokens -= batch.size();
+        }
+        return true;
+    }
+
+    bool connect()
+    {
+        if (socket.is_open())
+        {
+            return true;
+        }
+        try
+        {
+            tcp::resolver resolver(io_service);
+            tcp::resolver::query query(options.host, std::to_string(options.port));
+            boost::asio::connect(socket, resolver.resolve(query));
+            socket.set_option(tcp::no_delay(true));
+            if (wal_enabled && (reconnects > 0 || connect_failed))
+            {
+                // a queda acabou: o que já está no WAL acumulou durante ela e é
+                // reenviado no ritmo de recuperação
+                catchup_end = std::max(catchup_end, wal.end());
+            }
+            reconnects++;
+            connect_failed = false;
+            return true;
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "Graphite connect failed: " << e.what() << std::endl;
+            boost::system::error_code ignored_error;
+            socket.close(ignored_error);
+            connect_failed = true;
+            return false;
+        }
+    }
+
+    GraphiteOptions options;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Metric> queue;
+    std::chrono::steady_clock::time_point oldest;
+    std::atomic<bool> stopping{false};
+    std::thread worker;
+
+    bool wal_enabled = false;
+    MetricWal wal;
+    std::string wal_pending; // registros ainda não gravados, protegidos por mutex
+    size_t wal_pending_count = 0;
+    std::string unwritten; // só a thread de envio: registros cuja escrita no WAL falhou
+    size_t unwritten_count = 0;
+    std::chrono::steady_clock::time_point next_append;
+    std::chrono::steady_clock::time_point next_sync;
+    double tokens = 0;
+    std::chrono::steady_clock::time_point refill;
+    uint64_t catchup_end = 0; // só a thread de envio: fim do atraso da última queda
+    bool connect_failed = false;
+
+    boost::asio::io_service io_service;
+    tcp::socket socket;
+};
+
+GraphiteOptions graphite_options;
+GraphiteWriter graphite_writer;
+
+// Também usada para as métricas <processor_name>.self.*, que são publicadas
+// mesmo sem nenhuma máquina registrada (ex.: membro do cluster sem máquinas).
+void post_metric(std::string_view machine_id, std::string_view sensor_id, std::time_t timestamp, const float value)
+{
+    std::string path;
+    path.reserve(machine_id.size() + 1 + sensor_id.size());
+    path.append(machine_id).append(1, '.').append(sensor_id);
+    graphite_writer.enqueue(Metric{std::move(path), timestamp, value});
+}
+
+void report_graphite_stats()
+{
+    std::cout << "Graphite writer - queued: " << graphite_writer.queued
+              << " sent: " << graphite_writer.sent
+              << " dropped: " << graphite_writer.dropped
+              << " connections: " << graphite_writer.reconnects << std::endl;
+    if (!graphite_options.wal_dir.empty())
+    {
+        std::cout << "Graphite WAL - backlog: " << graphite_writer.wal_backlog() << " bytes"
+                  << " segments: " << graphite_writer.wal_segments()
+                  << " truncated: " << graphite_writer.wal_truncated() << std::endl;
+    }
+}
+
+// Fila circular lock-free de um produtor (thread de callback do Paho) e um
+// consumidor (worker).
+template <typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(size_t capacity) : slots(capacity), mask(capacity - 1) {}
+
+    bool push(T &&item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == slots.size())
+        {
+            return false;
+        }
+        slots[t & mask] = std::move(item);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &item)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        item = std::move(slots[h & mask]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+};
+
+// Mensagem na fila de um worker, com os horários de chegada no callback.
+struct Envelope
+{
+    mqtt::const_message_ptr msg;
+    int64_t received_ns = 0;          // epoch_ns(), comparável ao sent_ns do monitor
+    int64_t received_monotonic_ns = 0; // monotonic_ns(), para a espera na fila
+};
+
+// Cada worker atende uma partição (hash do machine_id) das máquinas, então os
+// locks das séries no registro praticamente nunca disputam entre workers.
+struct Worker
+{
+    Worker() : queue(WORKER_QUEUE_CAPACITY) {}
+
+    SpscQueue<Envelope> queue;
+    std::thread thread;
+    std::mutex park_mutex;
+    std::condition_variable park_cv;
+    std::atomic<bool> parked{false};
+    std::atomic<uint64_t> processed{0};
+    std::atomic<uint64_t> stalls{0};
+};
+
+size_t worker_count = WORKER_COUNT;
+std::vector<std::unique_ptr<Worker>> workers;
+std::atomic<bool> workers_stopping{false};
+
+void processing_alarm_data(uint64_t key)
+{
+    bool inactive = false;
+    bool owned = owns_machine(machine_names.name(uint32_t(key >> 32)));
+    series_registry.visit(uint32_t(key >> 32), uint32_t(key), [&](SeriesState &series)
+                                {
+                                    if (!owned)
+                                    {
+                                        // a máquina passou para outra instância: o timer morre aqui e,
+                                        // se ela voltar, o prazo recomeça do novo anúncio
+                                        series.timer_armed = false;
+                                        series.last_activity_ms = 0;
+                                        return;
+                                    }
+                                    int64_t now = monotonic_ms();
+                                    int64_t deadline = inactivity_deadline(series);
+                                    if (deadline <= now)
+                                    {
+                                        // sem leituras desde o prazo: alarma e volta a contar o período
+                                        inactive = true;
+                                        deadline = now + inactivity_period(series);
+                                    }
+                                    inactivity_timers.schedule(key, deadline); });
+
+    if (inactive)
+    {
+        const std::string &machine_id = machine_names.name(uint32_t(key >> 32));
+        const std::string &sensor_id = sensor_names.name(uint32_t(key));
+        post_metric(machine_id, "alarms.inactive." + sensor_id, std::time(nullptr), 1);
+    }
+}
+
+// Leitura no formato fixo {"timestamp": "...", "value": ...}. O timestamp
+// aponta para dentro do payload (ou do DOM de onde foi extraído).
+struct Reading
+{
+    std::string_view timestamp;
+    double value = 0;
+    uint64_t run = 0;    // início da execução do monitor, em ms desde a época; 0 = ausente
+    uint64_t seq = 0;    // número de sequência do sensor; 0 = ausente
+    int64_t sent_ns = 0; // horário de envio no monitor (ns desde a época); 0 = ausente
+};
+
+void skip_whitespace(std::string_view text, size_t &pos)
+{
+    while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r'))
+    {
+        pos++;
+    }
+}
+
+// String JSON sem escapes; retorna false se houver escape (o DOM trata).
+bool scan_plain_string(std::string_view text, size_t &pos, std::string_view &out)
+{
+    if (pos >= text.size() || text[pos] != '"')
+    {
+        return false;
+    }
+    size_t begin = ++pos;
+    while (pos < text.size() && text[pos] != '"')
+    {
+        if (text[pos] == '\\')
+        {
+            return false;
+        }
+        pos++;
+    }
+    if (pos >= text.size())
+    {
+        return false;
+    }
+    out = text.substr(begin, pos - begin);
+    pos++;
+    return true;
+}
+
+// Caminho rápido para o esquema fixo da leitura: percorre o payload uma vez, sem
+// montar DOM nem alocar. Campos desconhecidos com valores escalares são
+// ignorados; qualquer outra coisa devolve false para cair no parser geral.
+bool parse_reading_fast(std::string_view payload, Reading &reading)
+{
+    bool has_timestamp = false;
+    bool has_value = false;
+    size_t pos = 0;
+
+    skip_whitespace(payload, pos);
+    if (pos >= payload.size() || payload[pos++] != '{')
+    {
+        return false;
+    }
+
+    while (true)
+    {
+        std::string_view key;
+        skip_whitespace(payload, pos);
+        if (!scan_plain_string(payload, pos, key))
+        {
+            return false;
+        }
+        skip_whitespace(payload, pos);
+        if (pos >= payload.size() || payload[pos++] != ':')
+        {
+            return false;
+        }
+        skip_whitespace(payload, pos);
+        if (pos >= payload.size())
+        {
+            return false;
+        }
+
+        char first = payload[pos];
+        if (first == '"')
+        {
+            std::string_view text;
+            if (!scan_plain_string(payload, pos, text))
+            {
+                return false;
+            }
+            if (key == "timestamp")
+            {
+                reading.timestamp = text;
+                has_timestamp = true;
+            }
+        }
+        else if ((first >= '0' && first <= '9') && (key == "seq" || key == "run" || key == "sent_ns"))
+        {
+            // inteiros de 64 bits não cabem sem perda em um double
+            uint64_t number;
+            auto [end, error] = std::from_chars(payload.data() + pos, payload.data() + payload.size(), number);
+            if (error != std::errc() || (end < payload.data() + payload.size() && (*end == '.' || *end == 'e' || *end == 'E')))
+            {
+                return false;
+            }
+            pos = end - payload.data();
+            if (key == "seq")
+                reading.seq = number;
+            else if (key == "run")
+                reading.run = number;
+            else
+                reading.sent_ns = static_cast<int64_t>(number);
+        }
+        else if (first == '-' || (first >= '0' && first <= '9'))
+        {
+            double number;
+            auto [end, error] = std::from_chars(payload.data() + pos, payload.data() + payload.size(), number);
+            if (error != std::errc())
+            {
+                return false;
+            }
+            pos = end - payload.data();
+            if (key == "value")
+            {
+                reading.value = number;
+                has_value = true;
+            }
+        }
+        else if (payload.compare(pos, 4, "true") == 0 || payload.compare(pos, 4, "null") == 0)
+        {
+            pos += 4;
+        }
+        else if (payload.compare(pos, 5, "false") == 0)
+        {
+            pos += 5;
+        }
+        else
+        {
+            return false;
+        }
+
+        skip_whitespace(payload, pos);
+        if (pos >= payload.size())
+        {
+            return false;
+        }
+        char separator = payload[pos++];
+        if (separator == '}')
+        {
+            break;
+        }
+        if (separator != ',')
+        {
+            return false;
+        }
+    }
+
+    skip_whitespace(payload, pos);
+    return pos == payload.size() && has_timestamp && has_value;
+}
+
+// Extrai a leitura de um DOM já decodificado (JSON geral, CBOR ou MessagePack).
+Reading reading_from_json(const nlohmann::json &j)
+{
+    Reading reading;
+    reading.timestamp = j.at("timestamp").get_ref<const std::string &>();
+    reading.value = j.at("value").get<double>();
+    reading.run = j.value("run", uint64_t(0));
+    reading.seq = j.value("seq", uint64_t(0));
+    reading.sent_ns = j.value("sent_ns", int64_t(0));
+    return reading;
+}
+
+void process_reading(uint32_t machine, std::string_view machine_id, std::string_view sensor_id, const Reading &reading, int64_t received_ns)
+{
+    if (reading.sent_ns > 0)
+    {
+        stage_latency[STAGE_RECEIVE].record(received_ns - reading.sent_ns);
+    }
+
+    float value = static_cast<float>(reading.value);
+    int64_t sample_ms = timestamp2UNIX(reading.timestamp);
+
+    bool duplicate = false;
+    bool outlier = false;
+    series_registry.with_series(machine, sensor_names.intern(sensor_id), [&](SeriesState &series)
+                                {
+                                    series.last_activity_ms = monotonic_ms();
+                                    arm_inactivity_timer(series);
+                                    if (series.sequence.track(reading.run, reading.seq) == SequenceWindow::duplicate)
+                                    {
+                                        duplicate = true;
+                                        return;
+                                    }
+                                    series.last_sample_ms = sample_ms;
+                                    series.window.push(value);
+                                    outlier = is_outlier(value, series.window); });
+
+    if (duplicate)
+    {
+        // reentrega do QoS 1: o ponto já foi enviado ao Graphite
+        return;
+    }
+    // o Whisper guarda pontos com resolução de segundos
+    post_metric(machine_id, sensor_id, static_cast<std::time_t>(sample_ms / 1000), value);
+
+    if (outlier)
+    {
+        post_metric(machine_id, "alarms.outlier." + std::string(sensor_id), std::time(nullptr), 1);
+    }
+}
+
+// Resumo de uma janela agregada no monitor: cada campo vira a métrica
+// <máquina>.<sensor>.<campo>, com o timestamp do início da janela.
+void process_aggregate(uint32_t machine, std::string_view machine_id, std::string_view sensor_id, const nlohmann::json &j, int64_t received_ns)
+{
+    static const char *fields[] = {"min", "max", "mean", "last", "count"};
+
+    int64_t sent_ns = j.value("sent_ns", int64_t(0));
+    if (sent_ns > 0)
+    {
+        stage_latency[STAGE_RECEIVE].record(received_ns - sent_ns);
+    }
+    int64_t window_ms = timestamp2UNIX(j.at("timestamp").get_ref<const std::string &>());
+
+    bool duplicate = false;
+    series_registry.with_series(machine, sensor_names.intern(sensor_id), [&](SeriesState &series)
+                                {
+                                    series.last_activity_ms = monotonic_ms();
+                                    arm_inactivity_timer(series);
+                                    if (series.sequence.track(j.value("run", uint64_t(0)), j.value("seq", uint64_t(0))) == SequenceWindow::duplicate)
+                                    {
+                                        duplicate = true;
+                                        return;
+                                    }
+                                    series.last_sample_ms = window_ms; });
+    if (duplicate)
+    {
+        return;
+    }
+
+    std::string path(sensor_id);
+    path += '.';
+    size_t prefix = path.size();
+    for (const char *field : fields)
+    {
+        path.resize(prefix);
+        path += field;
+        post_metric(machine_id, path, static_cast<std::time_t>(window_ms / 1000), j.at(field).get<float>());
+    }
+}
+
+// Decodifica conforme o formato anunciado pela máquina. Antes do anúncio, JSON
+// é reconhecido pelo primeiro byte e o resto é tentado como CBOR e MessagePack.
+nlohmann::json decode_payload(const std::string &payload, PayloadFormat format)
+{
+    switch (format)
+    {
+    case PayloadFormat::cbor:
+        return nlohmann::json::from_cbor(payload);
+    case PayloadFormat::msgpack:
+        return nlohmann::json::from_msgpack(payload);
+    case PayloadFormat::json:
+        return nlohmann::json::parse(payload);
+    case PayloadFormat::unknown:
+        break;
+    }
+
+    if (!payload.empty() && (payload[0] == '{' || payload[0] == '['))
+    {
+        return nlohmann::json::parse(payload);
+    }
+    try
+    {
+        return nlohmann::json::from_cbor(payload);
+    }
+    catch (nlohmann::json::exception &)
+    {
+        return nlohmann::json::from_msgpack(payload);
+    }
+}
+
+void process_message(const Envelope &envelope)
+{
+    const mqtt::const_message_ptr &msg = envelope.msg;
+    const std::string &topic = msg->get_topic();
+    if (topic == "/sensor_monitors")
+    {
+        processInitialMessage(nlohmann::json::parse(msg->get_payload()));
+        return;
+    }
+
+    // /sensors/<machine_id>/<sensor_id> ou /sensor_batches/<machine_id>
+    std::string_view view(topic);
+    size_t machine_begin = view.find('/', 1);
+    if (machine_begin == std::string_view::npos)
+    {
+        return;
+    }
+
+    if (view.substr(0, machine_begin) == "/sensor_batches")
+    {
+        // lote: [{"sensor_id": ..., "timestamp": ..., "value": ...}, ...]
+        std::string_view machine_id = view.substr(machine_begin + 1);
+        if (!owns_machine(machine_id))
+        {
+            return; // ainda na fila quando a máquina foi perdida num rebalanceamento
+        }
+        uint32_t machine = machine_names.intern(machine_id);
+        int64_t parse_start = monotonic_ns();
+        auto j = decode_payload(msg->get_payload(), machine_registry.format_of(machine));
+        stage_latency[STAGE_PARSE].record(monotonic_ns() - parse_start);
+        for (const auto &reading : j)
+        {
+            const std::string &sensor_id = reading["sensor_id"].get_ref<const std::string &>();
+            process_reading(machine, machine_id, sensor_id, reading_from_json(reading), envelope.received_ns);
+        }
+        return;
+    }
+
+    size_t sensor_begin = view.find('/', machine_begin + 1);
+    if (sensor_begin == std::string_view::npos)
+    {
+        return;
+    }
+    std::string_view machine_id = view.substr(machine_begin + 1, sensor_begin - machine_begin - 1);
+    if (!owns_machine(machine_id))
+    {
+        return;
+    }
+    std::string_view sensor_id = view.substr(sensor_begin + 1);
+    uint32_t machine = machine_names.intern(machine_id);
+    PayloadFormat format = machine_registry.format_of(machine);
+
+    // /sensors/<machine_id>/<sensor_id>/agg: resumo de janela
+    size_t suffix = sensor_id.find('/');
+    if (suffix != std::string_view::npos)
+    {
+        if (sensor_id.substr(suffix) != "/agg")
+        {
+            return;
+        }
+        int64_t parse_start = monotonic_ns();
+        auto j = decode_payload(msg->get_payload(), format);
+        stage_latency[STAGE_PARSE].record(monotonic_ns() - parse_start);
+        process_aggregate(machine, machine_id, sensor_id.substr(0, suffix), j, envelope.received_ns);
+        return;
+    }
+
+    int64_t parse_start = monotonic_ns();
+    Reading reading;
+    if ((format == PayloadFormat::json || format == PayloadFormat::unknown) && parse_reading_fast(msg->get_payload(), reading))
+    {
+        stage_latency[STAGE_PARSE].record(monotonic_ns() - parse_start);
+        process_reading(machine, machine_id, sensor_id, reading, envelope.received_ns);
+        return;
+    }
+    auto j = decode_payload(msg->get_payload(), format);
+    reading = reading_from_json(j);
+    stage_latency[STAGE_PARSE].record(monotonic_ns() - parse_start);
+    process_reading(machine, machine_id, sensor_id, reading, envelope.received_ns);
+}
+
+void worker_loop(Worker &worker)
+{
+    Envelope envelope;
+    int idle_spins = 0;
+    while (!workers_stopping)
+    {
+        if (worker.queue.pop(envelope))
+        {
+            idle_spins = 0;
+            stage_latency[STAGE_QUEUE].record(monotonic_ns() - envelope.received_monotonic_ns);
+            try
+            {
+                process_message(envelope);
+            }
+            catch (std::exception &e)
+            {
+                std::cerr << "Error processing message on " << envelope.msg->get_topic() << ": " << e.what() << std::endl;
+            }
+            envelope.msg.reset();
+            worker.processed++;
+            continue;
+        }
+
+        if (++idle_spins < 64)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        // fila vazia: dorme até o callback sinalizar uma nova mensagem
+        std::unique_lock<std::mutex> lock(worker.park_mutex);
+        worker.parked.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (worker.queue.size() == 0)
+        {
+            worker.park_cv.wait_for(lock, std::chrono::milliseconds(10));
+        }
+        worker.parked.store(false);
+        idle_spins = 0;
+    }
+}
+
+void wake_worker(Worker &worker)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (worker.parked.load())
+    {
+        std::lock_guard<std::mutex> lock(worker.park_mutex);
+        worker.park_cv.notify_one();
+    }
+}
+
+// machine_id do tópico /sensors/<machine_id>/<sensor_id> ou /sensor_batches/<machine_id>;
+// vazio se o tópico não tiver esse segmento.
+std::string_view topic_machine(std::string_view topic)
+{
+    size_t begin = topic.find('/', 1);
+    if (begin == std::string_view::npos)
+    {
+        return {};
+    }
+    size_t end = topic.find('/', begin + 1);
+    return topic.substr(begin + 1, end == std::string_view::npos ? std::string_view::npos : end - begin - 1);
+}
+
+// Anúncios (sem machine_id no tópico) vão para o worker 0; leituras e lotes
+// para o worker dono da máquina.
+Worker &worker_for_topic(const std::string &topic)
+{
+    std::string_view machine_id = topic_machine(topic);
+    if (machine_id.empty())
+    {
+        return *workers[0];
+    }
+    return *workers[std::hash<std::string_view>{}(machine_id) % workers.size()];
+}
+
+void dispatch_message(mqtt::const_message_ptr msg)
+{
+    Worker &worker = worker_for_topic(msg->get_topic());
+    Envelope envelope{std::move(msg), epoch_ns(), monotonic_ns()};
+    while (!worker.queue.push(std::move(envelope)))
+    {
+        // fila cheia: segura o callback (e o broker) até o worker liberar espaço
+        worker.stalls++;
+        wake_worker(worker);
+        std::this_thread::yield();
+    }
+    wake_worker(worker);
+}
+
+void start_workers()
+{
+    for (size_t i = 0; i < worker_count; i++)
+    {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    for (auto &worker : workers)
+    {
+        worker->thread = std::thread(worker_loop, std::ref(*worker));
+    }
+}
+
+std::string processor_name = PROCESSOR_NAME;
+std::string snapshot_path;
+int snapshot_interval_ms = SNAPSHOT_INTERVAL_MS;
+
+// Assinaturas guiadas pelos anúncios: para cada máquina desta instância assina
+// /sensors/<máquina>/<sensor> de cada sensor anunciado (/agg nos agregados) e
+// /sensor_batches/<máquina>, em vez de /sensors/#. As mudanças são acumuladas e
+// enviadas a cada SUBSCRIPTION_FLUSH_MS em pacotes SUBSCRIBE/UNSUBSCRIBE de até
+// SUBSCRIPTION_BATCH filtros. Máquinas sem leituras por machine_expiry_ms são
+// esquecidas: saem das assinaturas, do registro e levam suas séries e timers.
+class SubscriptionManager
+{
+public:
+    void start(mqtt::async_client &client)
+    {
+        this->client = &client;
+        thread = std::thread(&SubscriptionManager::run, this);
+    }
+
+    void update(const std::string &machine_id, const nlohmann::json &announcement)
+    {
+        std::set<std::string> filters{"/sensor_batches/" + machine_id};
+        for (const auto &sensor : announcement["sensors"])
+        {
+            std::string topic = "/sensors/" + machine_id + "/" + sensor["sensor_id"].get<std::string>();
+            if (sensor.value("aggregate", false))
+            {
+                topic += "/agg";
+            }
+            filters.insert(std::move(topic));
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::set<std::string> &current = machines[machine_id];
+        if (current != filters)
+        {
+            current = std::move(filters);
+            dirty = true;
+        }
+    }
+
+    void remove(const std::string &machine_id)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        dirty |= machines.erase(machine_id) > 0;
+    }
+
+    int64_t machine_expiry_ms = MACHINE_EXPIRY_MS;
+    std::atomic<uint64_t> subscribe_packets{0};
+    std::atomic<uint64_t> unsubscribe_packets{0};
+    std::atomic<uint64_t> expired_machines{0};
+    std::atomic<size_t> filter_count{0};
+
+private:
+    void run()
+    {
+        int64_t next_expiry = monotonic_ms() + MACHINE_EXPIRY_CHECK_MS;
+        int64_t next_retry = 0;
+        while (true)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(SUBSCRIPTION_FLUSH_MS));
+            if (machine_expiry_ms > 0 && monotonic_ms() >= next_expiry)
+            {
+                expire_idle_machines();
+                next_expiry = monotonic_ms() + MACHINE_EXPIRY_CHECK_MS;
+            }
+            if (monotonic_ms() < next_retry)
+            {
+                continue;
+            }
+            try
+            {
+                flush();
+            }
+            catch (mqtt::exception &e)
+            {
+                // `subscribed` só registra os lotes confirmados; marca de novo
+                // como sujo para que o restante da diferença seja reenviado
+                std::cerr << "Error updating subscriptions: " << e.what() << std::endl;
+                std::lock_guard<std::mutex> lock(mutex);
+                dirty = true;
+                next_retry = monotonic_ms() + SUBSCRIPTION_RETRY_MS;
+            }
+        }
+    }
+
+    // Envia a diferença entre os filtros desejados e os já assinados.
+    void flush()
+    {
+        std::vector<std::string> added, removed;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!dirty)
+            {
+                return;
+            }
+            std::set<std::string> desired;
+            for (const auto &[machine_id, filters] : machines)
+            {
+                desired.insert(filters.begin(), filters.end());
+            }
+            std::set_difference(desired.begin(), desired.end(), subscribed.begin(), subscribed.end(), std::back_inserter(added));
+            std::set_difference(subscribed.begin(), subscribed.end(), desired.begin(), desired.end(), std::back_inserter(removed));
+            dirty = false;
+        }
+
+        for (size_t i = 0; i < removed.size(); i += SUBSCRIPTION_BATCH)
+        {
+            std::vector<std::string> batch(removed.begin() + i, removed.begin() + std::min(removed.size(), i + SUBSCRIPTION_BATCH));
+            client->unsubscribe(std::make_shared<mqtt::string_collection>(batch))->wait();
+            unsubscribe_packets++;
+            for (const auto &topic : batch)
+            {
+                subscribed.erase(topic);
+            }
+        }
+        for (size_t i = 0; i < added.size(); i += SUBSCRIPTION_BATCH)
+        {
+            std::vector<std::string> batch(added.begin() + i, added.begin() + std::min(added.size(), i + SUBSCRIPTION_BATCH));
+            client->subscribe(std::make_shared<mqtt::string_collection>(batch), mqtt::qos_collection(batch.size(), QOS))->wait();
+            subscribe_packets++;
+            subscribed.insert(batch.begin(), batch.end());
+        }
+        filter_count = subscribed.size();
+    }
+
+    void expire_idle_machines()
+    {
+        std::unordered_map<uint32_t, int64_t> last_activity;
+        series_registry.for_each([&](SeriesState &series)
+                                 {
+                                     int64_t &latest = last_activity[series.machine];
+                                     latest = std::max(latest, series.last_activity_ms); });
+
+        int64_t now = monotonic_ms();
+        std::vector<std::string> expired;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto &entry : machines)
+            {
+                auto it = last_activity.find(machine_names.intern(entry.first));
+                if (it != last_activity.end() && it->second > 0 && now - it->second > machine_expiry_ms)
+                {
+                    expired.push_back(entry.first);
+                }
+            }
+            for (const auto &machine_id : expired)
+            {
+                machines.erase(machine_id);
+                dirty = true;
+            }
+        }
+
+        for (const auto &machine_id : expired)
+        {
+            uint32_t machine = machine_names.intern(machine_id);
+            size_t series = series_registry.erase_machine(machine);
+            machine_registry.forget(machine);
+            expired_machines++;
+            std::cout << "Machine " << machine_id << " expired after " << machine_expiry_ms << " ms without readings ("
+                      << series << " series removed)" << std::endl;
+        }
+    }
+
+    mqtt::async_client *client = nullptr;
+    std::thread thread;
+    std::mutex mutex;
+    std::map<std::string, std::set<std::string>> machines; // filtros desejados por máquina
+    bool dirty = false;
+    std::set<std::string> subscribed; // só a thread de flush acessa
+};
+
+SubscriptionManager subscriptions;
+
+void subscribe_machine(const std::string &machine_id, const nlohmann::json &announcement)
+{
+    subscriptions.update(machine_id, announcement);
+}
+
+void unsubscribe_machine(const std::string &machine_id)
+{
+    subscriptions.remove(machine_id);
+}
+
+// Modo cluster: as instâncias de um grupo dividem as máquinas por um anel de
+// hash consistente com CLUSTER_VIRTUAL_NODES pontos por membro, de modo que a
+// entrada ou saída de um membro só move as máquinas dos arcos vizinhos. Cada
+// instância só entrega ao SubscriptionManager as máquinas que possui, então
+// séries, histórico de outliers e timers de inatividade existem em um único
+// nó. A filiação é mantida por heartbeats em /processors/<grupo>/members; a
+// mensagem de despedida também é registrada como last will, para que uma
+// queda seja notada sem esperar o timeout.
+class HashRing
+{
+public:
+    void rebuild(const std::vector<std::string> &members)
+    {
+        this->members = members;
+        points.clear();
+        points.reserve(members.size() * CLUSTER_VIRTUAL_NODES);
+        for (uint32_t m = 0; m < members.size(); m++)
+        {
+            for (int v = 0; v < CLUSTER_VIRTUAL_NODES; v++)
+            {
+                points.emplace_back(mix(hash_name(members[m] + "#" + std::to_string(v))), m);
+            }
+        }
+        std::sort(points.begin(), points.end());
+    }
+
+    const std::string &owner(std::string_view machine_id) const
+    {
+        static const std::string nobody;
+        if (points.empty())
+        {
+            return nobody;
+        }
+        auto it = std::lower_bound(points.begin(), points.end(), std::make_pair(mix(hash_name(machine_id)), uint32_t(0)));
+        return members[(it == points.end() ? points.front() : *it).second];
+    }
+
+private:
+    // finalizador do splitmix64: espalha hashes FNV de nomes parecidos pelo anel
+    static uint64_t mix(uint64_t x)
+    {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    std::vector<std::string> members;
+    std::vector<std::pair<uint64_t, uint32_t>> points;
 };
 
-std::map<std::pair<std::string, std::string>, std::time_t> last_sensor_activity;
-std::map<std::pair<std::string, std::string>, std::vector<float>> sensor_values_history;
+class ClusterPartitioner
+{
+public:
+    bool enabled() const { return !group.empty(); }
+
+    std::string control_topic() const { return "/processors/" + group + "/members"; }
+
+    std::string farewell() const { return nlohmann::json{{"member", member}, {"leaving", true}}.dump(); }
+
+    void start(mqtt::async_client &client)
+    {
+        this->client = &client;
+        members[member] = monotonic_ms();
+        client.subscribe(control_topic(), QOS);
+        thread = std::thread(&ClusterPartitioner::run, this);
+    }
+
+    bool owns(std::string_view machine_id) const
+    {
+        if (!enabled())
+        {
+            return true;
+        }
+        std::shared_lock<std::shared_mutex> lock(ring_mutex);
+        return ready && ring.owner(machine_id) == member;
+    }
+
+    // Heartbeat ou despedida de um membro, recebido no tópico de controle.
+    void on_member_message(const std::string &payload)
+    {
+        auto j = nlohmann::json::parse(payload);
+        const std::string &id = j.at("member").get_ref<const std::string &>();
+        std::lock_guard<std::mutex> lock(state_mutex);
+        if (j.value("leaving", false))
+        {
+            members_changed |= members.erase(id) > 0 && id != member;
+        }
+        else
+        {
+            members_changed |= members.emplace(id, 0).second;
+            members[id] = monotonic_ms();
+        }
+    }
+
+    // Todas as instâncias guardam o último anúncio de cada máquina, para que a
+    // nova dona possa criar as séries assim que assumir a máquina.
+    void on_announcement(const std::string &machine_id, const nlohmann::json &announcement)
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        auto [it, inserted] = machines.try_emplace(machine_id);
+        it->second.announcement = announcement;
+        if (inserted)
+        {
+            machines_changed = true;
+        }
+    }
+
+    std::atomic<uint64_t> dropped{0}; // mensagens de máquinas que não são (mais) desta instância
+    std::atomic<uint64_t> rebalances{0};
+
+    std::string group;
+    std::string member;
 
-std::vector<SensorInfo> firstMessages;
-std::vector<std::string> machine_ids;
+private:
+    struct Machine
+    {
+        nlohmann::json announcement;
+        bool owned = false;
+    };
+
+    void run()
+    {
+        int64_t started = monotonic_ms();
+        while (true)
+        {
+            try
+            {
+                client->publish(control_topic(), nlohmann::json{{"member", member}}.dump(), QOS, false);
+            }
+            catch (mqtt::exception &e)
+            {
+                std::cerr << "Error publishing cluster heartbeat: " << e.what() << std::endl;
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(CLUSTER_HEARTBEAT_MS));
+            int64_t now = monotonic_ms();
+            // antes do primeiro timeout o anel veria só esta instância e tomaria todas as máquinas
+            if (now - started >= CLUSTER_MEMBER_TIMEOUT_MS)
+            {
+                rebalance(now);
+            }
+        }
+    }
+
+    void rebalance(int64_t now)
+    {
+        std::vector<std::string> ids;
+        std::vector<std::pair<std::string, nlohmann::json>> gained;
+        std::vector<std::string> lost;
+        bool first_assignment = false;
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            members[member] = now;
+            for (auto it = members.begin(); it != members.end();)
+            {
+                if (now - it->second > CLUSTER_MEMBER_TIMEOUT_MS)
+                {
+                    it = members.erase(it);
+                    members_changed = true;
+                }
+                else
+                {
+                    ids.push_back(it->first);
+                    ++it;
+                }
+            }
+            if (!members_changed && !machines_changed && ready)
+            {
+                return;
+            }
+
+            {
+                std::unique_lock<std::shared_mutex> ring_lock(ring_mutex);
+                if (members_changed || !ready)
+                {
+                    ring.rebuild(ids);
+                    rebalances++;
+                }
+                first_assignment = !ready;
+                ready = true;
+            }
+            for (auto &[machine_id, machine] : machines)
+            {
+                bool owned = ring.owner(machine_id) == member;
+                if (owned && !machine.owned)
+                    gained.emplace_back(machine_id, machine.announcement);
+                else if (!owned && machine.owned)
+                    lost.push_back(machine_id);
+                machine.owned = owned;
+            }
+            if (members_changed)
+            {
+                std::cout << "Cluster " << group << " - members: " << ids.size() << " - gained: " << gained.size()
+                          << " - lost: " << lost.size() << std::endl;
+            }
+            members_changed = machines_changed = false;
+        }
+
+        for (const auto &machine_id : lost)
+        {
+            // o estado da máquina passa a viver só no novo dono; se ela voltar
+            // para cá, recomeça do anúncio em vez de reaproveitar histórico velho
+            unsubscribe_machine(machine_id);
+            uint32_t machine = machine_names.intern(machine_id);
+            series_registry.erase_machine(machine);
+            machine_registry.forget(machine);
+        }
+        for (const auto &entry : gained)
+        {
+            // cria as séries e as assinaturas da máquina
+            processInitialMessage(entry.second);
+            restore_series(entry.first);
+        }
+        if (first_assignment)
+        {
+            discard_restored_series();
+        }
+    }
+
+    mqtt::async_client *client = nullptr;
+    std::thread thread;
+
+    std::mutex state_mutex;
+    std::map<std::string, int64_t> members; // id -> monotonic_ms() do último heartbeat
+    std::map<std::string, Machine> machines;
+    bool members_changed = true;
+    bool machines_changed = false;
+
+    mutable std::shared_mutex ring_mutex;
+    HashRing ring;
+    bool ready = false;
+};
 
-std::string timestamp2UNIX(const std::string &timestamp)
+ClusterPartitioner cluster;
+
+bool owns_machine(std::string_view machine_id)
 {
-    std::tm t = {};
-    std::istringstream ss(timestamp);
-    ss >> std::get_time(&t, "%Y-%m-%dT%H:%M:%S");
-    std::time_t time_stamp = mktime(&t);
-    return std::to_string(time_stamp);
+    return cluster.owns(machine_id);
 }
 
-std::string UNIX2timestamp(const std::time_t &timestamp)
+void note_announcement(const std::string &machine_id, const nlohmann::json &announcement)
 {
-    std::tm *ptm = std::localtime(&timestamp);
-    char buffer[32];
-    std::strftime(buffer, 32, "%Y-%m-%dT%H:%M:%S", ptm);
-    return std::string(buffer);
+    if (cluster.enabled())
+    {
+        cluster.on_announcement(machine_id, announcement);
+    }
 }
 
-std::pair<float, float> calculate_mean_stddev(const std::vector<float> &data)
+// Chamado pelo callback do MQTT. Mensagens de controle do cluster são tratadas
+// aqui mesmo; leituras de máquinas que esta instância não possui (em trânsito
+// durante um rebalanceamento) são descartadas.
+void route_message(mqtt::const_message_ptr msg)
 {
-    float mean = std::accumulate(data.begin(), data.end(), 0.0) / data.size();
-    float sq_sum = std::inner_product(data.begin(), data.end(), data.begin(), 0.0);
-    float stddev = std::sqrt(sq_sum / data.size() - mean * mean);
-    return {mean, stddev};
+    if (cluster.enabled())
+    {
+        const std::string &topic = msg->get_topic();
+        if (topic == cluster.control_topic())
+        {
+            try
+            {
+                cluster.on_member_message(msg->get_payload());
+            }
+            catch (std::exception &e)
+            {
+                std::cerr << "Invalid cluster message: " << e.what() << std::endl;
+            }
+            return;
+        }
+        std::string_view machine_id = topic_machine(topic);
+        if (topic != "/sensor_monitors" && !machine_id.empty() && !owns_machine(machine_id))
+        {
+            cluster.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    dispatch_message(std::move(msg));
 }
 
-bool is_outlier(float value, const std::vector<float> &data)
+// Snapshots do estado analítico para um reinício a quente. Formato (ordem de
+// bytes do host):
+//   cabeçalho: magic, versão, criado em (ms desde a época), nº de máquinas,
+//              nº de séries, tamanho do corpo, CRC-32 do corpo
+//   máquinas:  [u16 tamanho][machine_id][u32 tamanho][último anúncio em JSON]
+//   séries:    [u16][machine_id][u16][sensor_id][i64 last_sample_ms]
+//              [u64 run][u64 primeira seq][u64 maior seq][u64 bitmap de seq]
+//              [u32 n][n floats do mais antigo ao mais novo]
+// Uma thread copia as séries partição a partição; sob o lock de cada partição
+// só são copiados os campos e o buffer circular bruto de cada série, e a
+// serialização é feita depois, sem travar a ingestão. O resultado vai para
+// <arquivo>.tmp, que depois de fsync substitui o anterior com rename(). Na
+// carga o arquivo é mapeado com mmap e lido sem cópias intermediárias.
+struct SnapshotHeader
 {
-    if (data.size() < 2)
-        return false;
-
-    auto [mean, stddev] = calculate_mean_stddev(data);
-    float z_score = (value - mean) / stddev;
-    return std::abs(z_score) > 3;
-}
+    uint32_t magic;
+    uint32_t version;
+    int64_t created_ms;
+    uint64_t machines;
+    uint64_t series;
+    uint64_t body_size;
+    uint32_t body_crc;
+    uint32_t reserved;
+};
 
-void processInitialMessage(const nlohmann::json &initialMessage)
+class SnapshotWriter
 {
-    if (std::find(machine_ids.begin(), machine_ids.end(), initialMessage["machine_id"]) != machine_ids.end())
+public:
+    void start(const std::string &path, int interval_ms)
     {
-        return;
-    }; // se o machine_id já estiver na lista, não faz nada
+        this->path = path;
+        this->interval_ms = interval_ms;
+        thread = std::thread(&SnapshotWriter::run, this);
+    }
 
-    int minDataInterval = std::numeric_limits<int>::max(); // maior valor possível para int
+    std::atomic<uint64_t> written{0};
+    std::atomic<uint64_t> failures{0};
+    std::atomic<uint64_t> last_size{0};
+    std::atomic<int64_t> last_duration_us{0};
 
-    for (const auto &sensor : initialMessage["sensors"])
+private:
+    template <typename T>
+    static void put(std::string &out, T value)
     {
-        int dataInterval = sensor["data_interval"];
-        if (dataInterval < minDataInterval)
+        out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    static void put_string16(std::string &out, std::string_view text)
+    {
+        put(out, static_cast<uint16_t>(text.size()));
+        out.append(text);
+    }
+
+    void run()
+    {
+        while (true)
         {
-            minDataInterval = dataInterval;
+            std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+            int64_t start = monotonic_ns();
+            if (write())
+            {
+                written++;
+                last_duration_us = (monotonic_ns() - start) / 1000;
+            }
+            else
+            {
+                failures++;
+            }
         }
     }
 
-    firstMessages.push_back(SensorInfo(initialMessage["machine_id"], minDataInterval));
-    machine_ids.push_back(initialMessage["machine_id"]);
-}
+    // Serializa em `body`, reaproveitado entre snapshots para não realocar.
+    bool write()
+    {
+        body.clear();
+        SnapshotHeader header{SNAPSHOT_MAGIC, SNAPSHOT_VERSION, epoch_ns() / 1000000, 0, 0, 0, 0, 0};
+
+        for (const auto &[machine, announcement] : machine_registry.announcements())
+        {
+            put_string16(body, machine_names.name(machine));
+            put(body, static_cast<uint32_t>(announcement.size()));
+            body.append(announcement);
+            header.machines++;
+        }
+
+        copies.clear();
+        raw_values.clear();
+        series_registry.for_each([&](SeriesState &series)
+                                 {
+                                     if (series.interval_ms == 0)
+                                     {
+                                         return; // nunca anunciada
+                                     }
+                                     SeriesCopy copy{series.machine, series.sensor, series.last_sample_ms,
+                                                     series.sequence.run, series.sequence.base,
+                                                     series.sequence.highest, series.sequence.seen,
+                                                     raw_values.size(), 0, 0};
+                                     copy.first = series.window.append_raw(raw_values);
+                                     copy.count = raw_values.size() - copy.offset;
+                                     copies.push_back(copy); });
+
+        for (const auto &copy : copies)
+        {
+            put_string16(body, machine_names.name(copy.machine));
+            put_string16(body, sensor_names.name(copy.sensor));
+            put(body, copy.last_sample_ms);
+            put(body, copy.run);
+            put(body, copy.base);
+            put(body, copy.highest);
+            put(body, copy.seen);
+            put(body, static_cast<uint32_t>(copy.count));
+            // do mais antigo ao fim do buffer, depois do início até o mais novo
+            const char *values = reinterpret_cast<const char *>(raw_values.data() + copy.offset);
+            body.append(values + copy.first * sizeof(float), (copy.count - copy.first) * sizeof(float));
+            body.append(values, copy.first * sizeof(float));
+            header.series++;
+        }
+
+        header.body_size = body.size();
+        header.body_crc = crc32(reinterpret_cast<const uint8_t *>(body.data()), body.size());
+
+        std::string temporary = path + ".tmp";
+        int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            std::cerr << "Error writing snapshot " << temporary << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        bool ok = write_all(fd, &header, sizeof(header)) && write_all(fd, body.data(), body.size()) && fsync(fd) == 0;
+        ok = close(fd) == 0 && ok;
+        if (!ok || rename(temporary.c_str(), path.c_str()) != 0)
+        {
+            std::cerr << "Error writing snapshot " << path << ": " << std::strerror(errno) << std::endl;
+            unlink(temporary.c_str());
+            return false;
+        }
+        last_size = sizeof(header) + body.size();
+        return true;
+    }
+
+    static bool write_all(int fd, const void *data, size_t size)
+    {
+        const char *p = static_cast<const char *>(data);
+        while (size > 0)
+        {
+            ssize_t n = ::write(fd, p, size);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                return false;
+            }
+            p += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    // Cópia de uma série feita sob o lock da partição; os valores ficam em
+    // raw_values[offset, offset + count), com o mais antigo em offset + first.
+    struct SeriesCopy
+    {
+        uint32_t machine;
+        uint32_t sensor;
+        int64_t last_sample_ms;
+        uint64_t run, base, highest, seen;
+        size_t offset, first, count;
+    };
+
+    std::string path;
+    int interval_ms = SNAPSHOT_INTERVAL_MS;
+    std::thread thread;
+    std::string body;
+    std::vector<SeriesCopy> copies; // reaproveitados entre snapshots
+    std::vector<float> raw_values;
+};
+
+SnapshotWriter snapshot_writer;
 
-void post_metric(const std::string &machine_id, const std::string &sensor_id, const std::string &timestamp_str, const float value)
+// Leitor sobre o arquivo mapeado; qualquer leitura além do fim invalida o resto.
+class SnapshotCursor
 {
-    if (firstMessages.empty())
+public:
+    SnapshotCursor(const uint8_t *data, size_t size) : p(data), end(data + size) {}
+
+    template <typename T>
+    bool get(T &value)
     {
-        return;
+        if (static_cast<size_t>(end - p) < sizeof(T))
+        {
+            return false;
+        }
+        std::memcpy(&value, p, sizeof(T));
+        p += sizeof(T);
+        return true;
     }
-    try
+
+    bool get_bytes(size_t size, std::string_view &bytes)
     {
-        boost::asio::io_service io_service;
+        if (static_cast<size_t>(end - p) < size)
+        {
+            return false;
+        }
+        bytes = std::string_view(reinterpret_cast<const char *>(p), size);
+        p += size;
+        return true;
+    }
 
-        tcp::resolver resolver(io_service);
-        tcp::resolver::query query(GRAPHITE_HOST, std::to_string(GRAPHITE_PORT));
-        tcp::resolver::iterator endpoint_iterator = resolver.resolve(query);
+    bool get_string16(std::string_view &text)
+    {
+        uint16_t size;
+        return get(size) && get_bytes(size, text);
+    }
 
-        tcp::socket socket(io_service);
-        boost::asio::connect(socket, endpoint_iterator);
+private:
+    const uint8_t *p;
+    const uint8_t *end;
+};
 
-        std::string metric_path = machine_id + "." + sensor_id;
-        std::string message = metric_path + " " + std::to_string(value) + " " + timestamp2UNIX(timestamp_str) + "\n";
+// Estado de uma série lido do snapshot, à espera de que a série exista.
+struct RestoredSeries
+{
+    std::string sensor_id;
+    int64_t last_sample_ms;
+    uint64_t run, base, highest, seen;
+    std::vector<float> values;
+};
 
-        boost::system::error_code ignored_error;
-        boost::asio::write(socket, boost::asio::buffer(message), ignored_error);
+// machine_id -> séries restauradas. Preenchido por load_snapshot() antes de o
+// cluster iniciar; depois disso só a thread do cluster o acessa.
+std::unordered_map<std::string, std::vector<RestoredSeries>> restored_series;
 
-        std::cout << "Metric sent: " << message << std::endl;
+// Devolve às séries já criadas pelo anúncio da máquina o histórico de outliers
+// e a janela de sequência do snapshot.
+void restore_series(const std::string &machine_id)
+{
+    auto it = restored_series.find(machine_id);
+    if (it == restored_series.end())
+    {
+        return;
     }
-    catch (std::exception &e)
+    uint32_t machine = machine_names.intern(machine_id);
+    for (const auto &restored : it->second)
     {
-        std::cerr << "Exception: " << e.what() << std::endl;
+        series_registry.visit(machine, sensor_names.intern(restored.sensor_id), [&](SeriesState &state)
+                              {
+                                  state.last_sample_ms = restored.last_sample_ms;
+                                  state.sequence.run = restored.run;
+                                  state.sequence.base = restored.base;
+                                  state.sequence.highest = restored.highest;
+                                  state.sequence.seen = restored.seen;
+                                  state.window = SensorWindow();
+                                  for (float value : restored.values)
+                                  {
+                                      state.window.push(value);
+                                  } });
     }
+    restored_series.erase(it);
+}
+
+// Depois da primeira divisão do cluster o restante pertence a outras
+// instâncias; se uma dessas máquinas vier para cá mais tarde, o histórico do
+// snapshot já estará velho.
+void discard_restored_series()
+{
+    restored_series.clear();
 }
 
-void processing_alarm_data(const int &interval)
+// Reanuncia as máquinas do snapshot (séries, timers e assinaturas, como um
+// anúncio recebido agora) e devolve às séries o histórico de outliers e a
+// janela de sequência. Em modo cluster nenhuma máquina é desta instância até a
+// primeira divisão do anel, então o estado fica em restored_series e é aplicado
+// por rebalance() às máquinas recebidas. Retorna false se não há snapshot válido.
+bool load_snapshot(const std::string &path)
 {
-    if (firstMessages.empty())
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
     {
-        return;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(SnapshotHeader))
+    {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    const uint8_t *data = static_cast<const uint8_t *>(map);
+    SnapshotHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    const uint8_t *body = data + sizeof(header);
+    bool valid = header.magic == SNAPSHOT_MAGIC && header.version == SNAPSHOT_VERSION &&
+                 header.body_size == size - sizeof(header) && crc32(body, header.body_size) == header.body_crc;
+    if (!valid)
+    {
+        std::cerr << "Ignoring invalid snapshot " << path << std::endl;
+        munmap(map, size);
+        return false;
+    }
+
+    SnapshotCursor cursor(body, header.body_size);
+    uint64_t machines = 0, series = 0;
+    try
+    {
+        for (; machines < header.machines; machines++)
+        {
+            std::string_view machine_id, announcement;
+            uint32_t announcement_size;
+            if (!cursor.get_string16(machine_id) || !cursor.get(announcement_size) || !cursor.get_bytes(announcement_size, announcement))
+            {
+                break;
+            }
+            processInitialMessage(nlohmann::json::parse(announcement));
+        }
+
+        for (; series < header.series; series++)
+        {
+            std::string_view machine_id, sensor_id;
+            int64_t last_sample_ms;
+            uint64_t run, base, highest, seen;
+            uint32_t count;
+            std::string_view raw;
+            if (!cursor.get_string16(machine_id) || !cursor.get_string16(sensor_id) || !cursor.get(last_sample_ms) ||
+                !cursor.get(run) || !cursor.get(base) || !cursor.get(highest) || !cursor.get(seen) || !cursor.get(count) || !cursor.get_bytes(size_t(count) * sizeof(float), raw))
+            {
+                break;
+            }
+            std::vector<float> values(count);
+            std::memcpy(values.data(), raw.data(), raw.size());
+            restored_series[std::string(machine_id)].push_back(
+                RestoredSeries{std::string(sensor_id), last_sample_ms, run, base, highest, seen, std::move(values)});
+        }
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Error loading snapshot " << path << ": " << e.what() << std::endl;
     }
+    munmap(map, size);
 
-    std::time_t current_time = std::time(nullptr);
-    for (auto &activity : last_sensor_activity)
+    if (!cluster.enabled())
     {
-        std::pair<std::string, std::string> machine_sensor_pair = activity.first;
-        std::time_t last_time = activity.second;
-        std::string machine_id = activity.first.first;
-        std::string sensor_id = activity.first.second;
+        while (!restored_series.empty())
+        {
+            restore_series(restored_series.begin()->first);
+        }
+    }
+
+    int64_t age_s = (epoch_ns() / 1000000 - header.created_ms) / 1000;
+    std::cout << "Snapshot " << path << " loaded: " << machines << " machines, " << series << " series (" << age_s << " s old)" << std::endl;
+    return true;
+}
+
+// Publica p50/p99/p999 (em ms) de cada estágio desde o último relatório como
+// <processor_name>.self.latency.<estágio>.<percentil>.
+void report_latency()
+{
+    static const std::pair<const char *, double> percentiles[] = {{"p50", 0.5}, {"p99", 0.99}, {"p999", 0.999}};
+    std::vector<uint64_t> snapshot;
+    std::time_t now = std::time(nullptr);
 
-        if (current_time - last_time >= (interval / 1000) * 10)
+    for (int stage = 0; stage < STAGE_COUNT; stage++)
+    {
+        uint64_t total = stage_latency[stage].drain(snapshot);
+        if (total == 0)
+        {
+            continue;
+        }
+        std::cout << "Latency " << latency_stage_names[stage] << " (ms) -";
+        for (const auto &[name, quantile] : percentiles)
         {
-            std::string alarm_path = machine_id + ".alarms.inactive." + sensor_id;
-            std::string message = alarm_path + " 1 " + UNIX2timestamp(current_time) + "\n";
-            post_metric(machine_id, "alarms.inactive." + sensor_id, UNIX2timestamp(current_time), 1);
+            double ms = LatencyHistogram::percentile(snapshot, total, quantile) / 1e6;
+            post_metric(processor_name, std::string("self.latency.") + latency_stage_names[stage] + "." + name, now, static_cast<float>(ms));
+            std::cout << " " << name << ": " << ms;
         }
+        std::cout << " (" << total << " samples)" << std::endl;
     }
 }
-void processing_outlier_data()
+
+// Publica, para cada série com números de sequência, a fração de leituras
+// perdidas desde o último relatório (<máquina>.<sensor>.loss_rate) e os totais
+// do processador em <processor_name>.self.sequence.*.
+void report_sequence_stats()
 {
-    if (firstMessages.empty())
+    uint64_t received = 0, lost = 0, duplicates = 0, reordered = 0, restarts = 0;
+    std::time_t now = std::time(nullptr);
+
+    series_registry.for_each([&](SeriesState &series)
+                             {
+                                 const SequenceWindow &sequence = series.sequence;
+                                 if (sequence.highest == 0)
+                                 {
+                                     return;
+                                 }
+                                 uint64_t new_received = sequence.received - series.reported_received;
+                                 // perdas podem ser desfeitas por reordenações tardias
+                                 int64_t new_lost = static_cast<int64_t>(sequence.lost) - static_cast<int64_t>(series.reported_lost);
+                                 uint64_t expected = new_received + std::max<int64_t>(new_lost, 0);
+                                 if (expected > 0)
+                                 {
+                                     post_metric(machine_names.name(series.machine),
+                                                 std::string(sensor_names.name(series.sensor)) + ".loss_rate", now,
+                                                 static_cast<float>(std::max<int64_t>(new_lost, 0)) / expected);
+                                 }
+                                 received += new_received;
+                                 lost += std::max<int64_t>(new_lost, 0);
+                                 duplicates += sequence.duplicates - series.reported_duplicates;
+                                 reordered += sequence.reordered;
+                                 restarts += sequence.restarts;
+                                 series.reported_received = sequence.received;
+                                 series.reported_lost = sequence.lost;
+                                 series.reported_duplicates = sequence.duplicates; });
+
+    if (received + lost == 0 && duplicates == 0)
     {
         return;
     }
-    for (auto &sensor : firstMessages)
+    float loss_rate = received + lost > 0 ? static_cast<float>(lost) / (received + lost) : 0;
+    post_metric(processor_name, "self.sequence.received", now, received);
+    post_metric(processor_name, "self.sequence.lost", now, lost);
+    post_metric(processor_name, "self.sequence.duplicates", now, duplicates);
+    post_metric(processor_name, "self.sequence.loss_rate", now, loss_rate);
+    std::cout << "Sequence - received: " << received << " lost: " << lost << " (" << loss_rate * 100 << "%)"
+              << " duplicates dropped: " << duplicates << " reordered (total): " << reordered
+              << " monitor restarts (total): " << restarts << std::endl;
+}
+
+void report_worker_stats()
+{
+    for (size_t i = 0; i < workers.size(); i++)
     {
-        std::pair<std::string, std::string> machine_sensor_pair = {sensor.id, sensor.id};
-        if (sensor_values_history.find(machine_sensor_pair) != sensor_values_history.end())
-        {
-            if (is_outlier(sensor_values_history[machine_sensor_pair].back(), sensor_values_history[machine_sensor_pair]))
-            {
-                std::string alarm_path = sensor.id + ".alarms.outlier." + sensor.id;
-                std::string message = alarm_path + " 1 " + UNIX2timestamp(std::time(nullptr)) + "\n";
-                post_metric(sensor.id, "alarms.outlier." + sensor.id, UNIX2timestamp(std::time(nullptr)), 1);
-            }
-        }
+        std::cout << "Worker " << i << " - queue depth: " << workers[i]->queue.size()
+                  << " processed: " << workers[i]->processed
+                  << " stalls: " << workers[i]->stalls << std::endl;
     }
 }
 
-std::vector<std::string> split(const std::string &str, char delim)
+// Custo por leitura do parse com DOM (caminho anterior) contra o caminho rápido.
+void benchmark_parse(int iterations)
 {
-    std::vector<std::string> tokens;
-    std::string token;
-    std::istringstream tokenStream(str);
-    while (std::getline(tokenStream, token, delim))
+    using Clock = std::chrono::steady_clock;
+    const std::string payload = R"({"timestamp":"2023-06-01T15:30:00Z","value":0.4942436218261719})";
+    auto ns_per_op = [iterations](Clock::time_point start)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count() / iterations;
+    };
+    volatile double sink = 0;
+
+    auto start = Clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        auto j = nlohmann::json::parse(payload);
+        std::string timestamp = j["timestamp"];
+        float value = j["value"];
+        sink = sink + value + timestamp.size();
+    }
+    std::cout << "nlohmann::json::parse: " << ns_per_op(start) << " ns/reading" << std::endl;
+
+    start = Clock::now();
+    for (int i = 0; i < iterations; i++)
     {
-        tokens.push_back(token);
+        Reading reading;
+        parse_reading_fast(payload, reading);
+        sink = sink + reading.value + reading.timestamp.size();
     }
-    return tokens;
+    std::cout << "parse_reading_fast: " << ns_per_op(start) << " ns/reading" << std::endl;
 }
 
-int main(int argc, char *argv[])
+// Custo por leitura da conversão anterior (istringstream + get_time + mktime +
+// to_string) contra parse_iso8601 formatado com to_chars.
+void benchmark_timestamp(int iterations)
 {
-    std::string clientId = "clientId";
-    mqtt::async_client client(BROKER_ADDRESS, clientId);
+    using Clock = std::chrono::steady_clock;
+    const std::string timestamp = "2023-06-01T15:30:00Z";
+    auto ns_per_op = [iterations](Clock::time_point start)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count() / iterations;
+    };
+    volatile size_t sink = 0;
 
-    class callback : public virtual mqtt::callback
+    auto start = Clock::now();
+    for (int i = 0; i < iterations; i++)
     {
-    public:
-        void message_arrived(mqtt::const_message_ptr msg) override
-        {
-            auto j = nlohmann::json::parse(msg->get_payload());
+        std::tm t = {};
+        std::istringstream ss(timestamp);
+        ss >> std::get_time(&t, "%Y-%m-%dT%H:%M:%S");
+        std::string text = std::to_string(mktime(&t));
+        sink = sink + text.size();
+    }
+    std::cout << "get_time + mktime + to_string: " << ns_per_op(start) << " ns/timestamp" << std::endl;
+
+    start = Clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        char text[24];
+        char *end = std::to_chars(text, text + sizeof(text), static_cast<long long>(timestamp2UNIX(timestamp) / 1000)).ptr;
+        sink = sink + (end - text);
+    }
+    std::cout << "parse_iso8601 + to_chars: " << ns_per_op(start) << " ns/timestamp" << std::endl;
+}
+
+std::string benchmark;
+
+bool parse_options(int argc, char *argv[])
+{
+    bool port_set = false;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        std::string name = arg.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
 
-            std::string topic = msg->get_topic();
-            if (topic == "/sensor_monitors")
+        try
+        {
+            if (name == "--graphite-host")
+                graphite_options.host = value;
+            else if (name == "--graphite-port")
             {
-                processInitialMessage(j);
-                return;
+                graphite_options.port = std::stoi(value);
+                port_set = true;
             }
+            else if (name == "--graphite-protocol" && (value == "plaintext" || value == "pickle"))
+                graphite_options.protocol = value == "pickle" ? GraphiteProtocol::pickle : GraphiteProtocol::plaintext;
+            else if (name == "--graphite-batch")
+                graphite_options.max_batch = std::max(1, std::stoi(value));
+            else if (name == "--graphite-linger-ms")
+                graphite_options.max_linger_ms = std::max(0, std::stoi(value));
+            else if (name == "--wal")
+                graphite_options.wal_dir = value;
+            else if (name == "--wal-segment-mb")
+                graphite_options.wal_segment_bytes = std::max(1, std::stoi(value)) * (1ull << 20);
+            else if (name == "--wal-catchup-rate")
+                graphite_options.wal_catchup_rate = std::max(1.0, std::stod(value));
+            else if (name == "--history-window")
+                SensorWindow::history_window = std::max(2, std::stoi(value));
+            else if (name == "--workers")
+                worker_count = std::max(1, std::stoi(value));
+            else if (name == "--name" && !value.empty())
+                processor_name = value;
+            else if (name == "--cluster" && !value.empty())
+                cluster.group = value;
+            else if (name == "--member" && !value.empty())
+                cluster.member = value;
+            else if (name == "--snapshot")
+                snapshot_path = value;
+            else if (name == "--snapshot-interval-ms")
+                snapshot_interval_ms = std::max(100, std::stoi(value));
+            else if (name == "--machine-expiry-ms")
+                subscriptions.machine_expiry_ms = std::max(0, std::stoi(value));
+            else if (name == "--bench" && (value == "parse" || value == "timestamp"))
+                benchmark = value;
             else
             {
-                auto topic_parts = split(topic, '/');
-                std::string machine_id = topic_parts[2];
-                std::string sensor_id = topic_parts[3];
+                std::cerr << "Unknown option: " << arg << std::endl;
+                return false;
+            }
+        }
+        catch (std::logic_error &)
+        {
+            // std::stoi/std::stod: valor não numérico ou fora do intervalo
+            std::cerr << "Invalid value: " << arg << std::endl;
+            return false;
+        }
+    }
+    if (!port_set && graphite_options.protocol == GraphiteProtocol::pickle)
+    {
+        graphite_options.port = GRAPHITE_PICKLE_PORT;
+    }
+    return true;
+}
 
-                std::string timestamp = j["timestamp"];
-                float value = j["value"];
-                post_metric(machine_id, sensor_id, timestamp, value);
+int main(int argc, char *argv[])
+{
+    if (!parse_options(argc, argv))
+    {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--graphite-host=<host>] [--graphite-port=<port>]"
+                  << " [--graphite-protocol=plaintext|pickle] [--graphite-batch=<n>] [--graphite-linger-ms=<ms>]"
+                  << " [--wal=<dir> [--wal-segment-mb=<MB>] [--wal-catchup-rate=<metrics/s>]]"
+                  << " [--history-window=<n>] [--workers=<n>] [--name=<processor>]"
+                  << " [--cluster=<group> [--member=<id>]] [--machine-expiry-ms=<ms>]"
+                  << " [--snapshot=<path> [--snapshot-interval-ms=<ms>]]"
+                  << " [--bench=parse|timestamp]" << std::endl;
+        return EXIT_FAILURE;
+    }
 
-                std::pair<std::string, std::string> machine_sensor_pair = {machine_id, sensor_id};
-                last_sensor_activity[machine_sensor_pair] = std::time(nullptr);
+    if (benchmark == "parse")
+    {
+        benchmark_parse(1000000);
+        return EXIT_SUCCESS;
+    }
+    if (benchmark == "timestamp")
+    {
+        benchmark_timestamp(1000000);
+        return EXIT_SUCCESS;
+    }
 
-                sensor_values_history[machine_sensor_pair].push_back(value);
+    // cada instância precisa de um client ID próprio, senão o broker derruba a anterior
+    std::string clientId = processor_name + "-" + std::to_string(getpid());
+    if (cluster.enabled() && cluster.member.empty())
+    {
+        cluster.member = clientId;
+    }
+    mqtt::async_client client(BROKER_ADDRESS, cluster.enabled() ? cluster.member : clientId);
 
-                if (sensor_values_history.find(machine_sensor_pair) != sensor_values_history.end())
-                {
-                    if (is_outlier(value, sensor_values_history[machine_sensor_pair]))
-                    {
-                        std::string alarm_path = machine_id + ".alarms.outlier." + sensor_id;
-                        std::string message = alarm_path + " 1 " + UNIX2timestamp(std::time(nullptr)) + "\n";
-                        post_metric(machine_id, "alarms.outlier." + sensor_id, UNIX2timestamp(std::time(nullptr)), 1);
-                    }
-                }
-            }
+    class callback : public virtual mqtt::callback
+    {
+    public:
+        void message_arrived(mqtt::const_message_ptr msg) override
+        {
+            route_message(std::move(msg));
         }
     };
 
     callback cb;
     client.set_callback(cb);
 
+    if (!snapshot_path.empty())
+    {
+        // antes de assinar qualquer coisa, para as leituras já encontrarem o histórico
+        load_snapshot(snapshot_path);
+    }
+
+    if (!graphite_writer.start(graphite_options))
+    {
+        return EXIT_FAILURE;
+    }
+    inactivity_timers.start(processing_alarm_data);
+    start_workers();
+    if (!snapshot_path.empty())
+    {
+        snapshot_writer.start(snapshot_path, snapshot_interval_ms);
+    }
+
     mqtt::connect_options connOpts;
     connOpts.set_keep_alive_interval(20);
     connOpts.set_clean_session(true);
+    if (cluster.enabled())
+    {
+        connOpts.set_will(mqtt::will_options(cluster.control_topic(), cluster.farewell(), QOS, false));
+    }
 
     try
     {
         client.connect(connOpts)->wait();
-        client.subscribe("/sensors/#", QOS);
-        client.subscribe("/sensor_monitors", QOS); 
+        // as leituras são assinadas máquina a máquina conforme os anúncios
+        subscriptions.start(client);
+        if (cluster.enabled())
+        {
+            cluster.start(client);
+        }
+        client.subscribe("/sensor_monitors", QOS);
     }
     catch (mqtt::exception &e)
     {
@@ -242,20 +3588,41 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    // Só uma instância isolada espera o primeiro anúncio; depois disso (ou em
+    // modo cluster, onde um membro pode não ter máquina alguma) as estatísticas
+    // seguem mesmo que todas as máquinas expirem.
+    bool announced = cluster.enabled();
     while (true)
     {
-        if (firstMessages.empty())
+        if (!announced && machine_registry.empty())
         {
             std::cout << "Waiting for initial messages..." << std::endl;
             std::this_thread::sleep_for(std::chrono::milliseconds(100));
             system("clear");
             continue;
-        };
+        }
+        announced = true;
 
-        for (auto &sensor : firstMessages)
+        // os alarmes de inatividade são disparados pela timing wheel
+        std::this_thread::sleep_for(std::chrono::milliseconds(STATS_INTERVAL_MS));
+        std::cout << "Inactivity timers - armed: " << inactivity_timers.size()
+                  << " expired: " << inactivity_timers.expired << std::endl;
+        report_graphite_stats();
+        report_worker_stats();
+        report_latency();
+        report_sequence_stats();
+        if (!snapshot_path.empty())
+        {
+            std::cout << "Snapshots - written: " << snapshot_writer.written << " failed: " << snapshot_writer.failures
+                      << " last: " << snapshot_writer.last_size << " bytes in " << snapshot_writer.last_duration_us << " us" << std::endl;
+        }
+        std::cout << "Subscriptions - filters: " << subscriptions.filter_count
+                  << " SUBSCRIBE/UNSUBSCRIBE packets: " << subscriptions.subscribe_packets << "/" << subscriptions.unsubscribe_packets
+                  << " expired machines: " << subscriptions.expired_machines << std::endl;
+        if (cluster.enabled())
         {
-            processing_alarm_data(sensor.interval);
-            std::this_thread::sleep_for(std::chrono::milliseconds(sensor.interval));
+            std::cout << "Cluster " << cluster.group << " - member: " << cluster.member
+                      << " - rebalances: " << cluster.rebalances << " - dropped: " << cluster.dropped << std::endl;
         }
     }
 
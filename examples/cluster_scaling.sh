@@ -0,0 +1,172 @@
+#!/usr/bin/env bash
+# Teste local de escalabilidade do modo cluster do data_processor.
+#
+# Para cada quantidade de instâncias (padrão: 1 2 4), sobe um mosquitto local na
+# porta 1883, inicia as instâncias com --cluster=bench, anuncia MACHINES
+# máquinas sintéticas e publica READINGS leituras por máquina o mais rápido
+# possível. Um Graphite falso conta as métricas bench-m<n>.load que chegam e a
+# vazão é calculada entre a primeira e a última delas.
+#
+# Requer mosquitto, mosquitto_pub e python3 no PATH e o data_processor já
+# compilado (DATA_PROCESSOR=build/data_processor por padrão). Como o broker e os
+# geradores de carga dividem a mesma máquina com os processadores, o ganho
+# observado é limitado pelos núcleos livres; com o broker como gargalo a curva
+# achata antes de N instâncias.
+#
+#   examples/cluster_scaling.sh [instâncias...]
+
+set -euo pipefail
+
+DATA_PROCESSOR=${DATA_PROCESSOR:-build/data_processor}
+MACHINES=${MACHINES:-64}
+READINGS=${READINGS:-20000}
+GRAPHITE_PORT=${GRAPHITE_PORT:-22003}
+WORKERS=${WORKERS:-2}
+if (($#)); then
+    COUNTS=("$@")
+else
+    COUNTS=(1 2 4)
+fi
+
+WORKDIR=$(mktemp -d)
+PIDS=()
+
+cleanup_round()
+{
+    for pid in "${PIDS[@]}"; do
+        kill "$pid" 2>/dev/null || true
+    done
+    wait 2>/dev/null || true
+    PIDS=()
+}
+
+cleanup()
+{
+    cleanup_round
+    rm -rf "$WORKDIR"
+}
+trap cleanup EXIT
+
+for tool in mosquitto mosquitto_pub python3 "$DATA_PROCESSOR"; do
+    if ! command -v "$tool" >/dev/null; then
+        echo "not found: $tool" >&2
+        exit 1
+    fi
+done
+
+# Graphite falso: grava em $1 "<métricas> <primeira> <última>" (segundos) a cada 200 ms.
+start_graphite()
+{
+    python3 - "$GRAPHITE_PORT" "$1" <<'EOF' &
+import os, re, socket, sys, threading, time
+port, out = int(sys.argv[1]), sys.argv[2]
+state = {"count": 0, "first": 0.0, "last": 0.0}
+lock = threading.Lock()
+reading = re.compile(rb"bench-m\d+\.load ")
+
+def serve(conn):
+    pending = b""
+    while True:
+        data = conn.recv(1 << 16)
+        if not data:
+            return
+        lines = (pending + data).split(b"\n")
+        pending = lines.pop()
+        n = sum(1 for line in lines if reading.match(line))
+        if n:
+            now = time.time()
+            with lock:
+                state["first"] = state["first"] or now
+                state["count"] += n
+                state["last"] = now
+
+def report():
+    while True:
+        time.sleep(0.2)
+        with lock:
+            line = "%d %.3f %.3f\n" % (state["count"], state["first"], state["last"])
+        with open(out + ".tmp", "w") as f:
+            f.write(line)
+        os.replace(out + ".tmp", out)
+
+server = socket.socket()
+server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+server.bind(("127.0.0.1", port))
+server.listen()
+threading.Thread(target=report, daemon=True).start()
+while True:
+    conn, _ = server.accept()
+    threading.Thread(target=serve, args=(conn,), daemon=True).start()
+EOF
+    PIDS+=($!)
+}
+
+announce()
+{
+    for ((m = 0; m < MACHINES; m++)); do
+        mosquitto_pub -q 1 -t /sensor_monitors -m \
+            "{\"machine_id\":\"bench-m$m\",\"sensors\":[{\"sensor_id\":\"load\",\"data_type\":\"float\",\"data_interval\":1000}]}"
+    done
+}
+
+# Um mosquitto_pub por máquina, cada um lendo as leituras da entrada padrão.
+publish()
+{
+    local run publishers=()
+    run=$(date +%s%3N)
+    for ((m = 0; m < MACHINES; m++)); do
+        awk -v n="$READINGS" -v run="$run" 'BEGIN {
+            for (i = 1; i <= n; i++)
+                printf "{\"timestamp\":\"2024-01-01T00:00:%02dZ\",\"value\":%d,\"run\":%s,\"seq\":%d}\n", i % 60, i % 100, run, i
+        }' | mosquitto_pub -q 1 -l -t "/sensors/bench-m$m/load" &
+        publishers+=($!)
+    done
+    wait "${publishers[@]}"
+}
+
+run_round()
+{
+    local instances=$1
+    local counter=$WORKDIR/count-$instances
+    PIDS=()
+
+    mosquitto -p 1883 >"$WORKDIR/mosquitto.log" 2>&1 &
+    PIDS+=($!)
+    start_graphite "$counter"
+    sleep 1
+
+    for ((i = 0; i < instances; i++)); do
+        "$DATA_PROCESSOR" --cluster=bench --member="p$i" --name="bench-p$i" --workers="$WORKERS" \
+            --graphite-host=127.0.0.1 --graphite-port="$GRAPHITE_PORT" >"$WORKDIR/p$i.log" 2>&1 &
+        PIDS+=($!)
+    done
+    # a posse das máquinas só é assumida depois do primeiro timeout de membros
+    sleep 5
+    announce
+    sleep 2
+
+    publish
+    local expected=$((MACHINES * READINGS))
+    local previous=-1 stalled=0 count=0 first=0 last=0
+    # espera todas as leituras ou 3 s sem progresso
+    while ((count < expected && stalled < 3)); do
+        sleep 1
+        [[ -f $counter ]] && read -r count first last <"$counter"
+        if ((count == previous)); then
+            stalled=$((stalled + 1))
+        else
+            stalled=0
+        fi
+        previous=$count
+    done
+
+    local rate
+    rate=$(python3 -c "print(round($count / max($last - $first, 1e-3)))")
+    printf "%2d instance(s): %9d / %d readings, %8d readings/s\n" "$instances" "$count" "$expected" "$rate"
+
+    cleanup_round
+}
+
+for instances in "${COUNTS[@]}"; do
+    run_round "$instances"
+done
@@ -5,7 +5,7 @@
 #include <thread>
 #include <unistd.h>
 #include "json.hpp"
-#include "mqtt/client.h"
+#include "mqtt/async_client.h"
 #include <iomanip>
 #include <iostream>
 #include <fstream>
@@ -14,6 +14,20 @@
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
+#include <queue>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <string_view>
+#include <fcntl.h>
+#include <sys/statvfs.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <array>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 #define QOS 1
 #define BROKER_ADDRESS "tcp://localhost:1883"
@@ -23,13 +37,185 @@ struct SensorInfo
     std::string id;
     std::string type;
     int interval;
-    SensorInfo(std::string id, std::string type, int interval)
-        : id(id), type(type), interval(interval) {}
+    float (*read)(); // resolved once at startup from the sensor registry
+    bool rate = false; // read() returns the change since the previous read
+    uint64_t seq = 0; // per-sensor sequence number of the last reading sent
+    int aggregateWindow = 0; // ms; > 0 publishes one summary per window instead of every sample
+
+    // Report-by-exception: a reading is only published when it moves more than
+    // deadband (absolute, or percent of the last published value) or when
+    // heartbeatInterval ms have passed since the last publish. 0 = every tick.
+    float deadband = 0;
+    bool deadbandRelative = false;
+    int heartbeatInterval = 0;
+    bool published = false;
+    float lastPublishedValue = 0;
+    std::chrono::steady_clock::time_point lastPublishedAt;
+    uint64_t suppressed = 0;
+    SensorInfo(std::string id, std::string type, int interval, float (*read)(), int aggregateWindow = 0)
+        : id(id), type(type), interval(interval), read(read), aggregateWindow(aggregateWindow) {}
+
+    // Running summary of the current tumbling window, aligned to multiples of
+    // aggregateWindow since the epoch so windows line up across machines.
+    struct Aggregate
+    {
+        int64_t window = -1; // epoch ms / aggregateWindow
+        uint64_t count = 0;
+        float min = 0;
+        float max = 0;
+        double sum = 0;
+        float last = 0;
+    } aggregate;
 };
 
 int messagesSent = 0;
 std::vector<SensorInfo> sensors;
 
+// Start time of this run in ms since the epoch, sent with every reading. The
+// processor resets a sensor's sequence window when it sees a newer run, so a
+// restart is told apart from a redelivered or reordered seq 1.
+const uint64_t runId = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+// Encoding of reading payloads, announced to the processor in the initial
+// message. The initial message itself is always JSON.
+std::string payloadFormat = "json";
+
+std::vector<std::uint8_t> encodePayload(const nlohmann::json &j)
+{
+    if (payloadFormat == "cbor")
+    {
+        return nlohmann::json::to_cbor(j);
+    }
+    if (payloadFormat == "msgpack")
+    {
+        return nlohmann::json::to_msgpack(j);
+    }
+    std::string text = j.dump();
+    return std::vector<std::uint8_t>(text.begin(), text.end());
+}
+
+// Batch mode: readings are accumulated and published together as a JSON array
+// on /sensor_batches/<machine_id> once batchSize readings are pending or the
+// oldest one is batchMaxAgeMs old. Disabled when batchSize is 0.
+size_t batchSize = 0;
+int batchMaxAgeMs = 1000;
+nlohmann::json pendingBatch = nlohmann::json::array();
+std::chrono::steady_clock::time_point pendingBatchStart;
+uint64_t currentTick = 0; // bumped by the scheduler before each tick
+
+// A procfs/sysfs file kept open and re-read with pread into a reusable buffer.
+// The contents are cached per scheduler tick, so every sensor due in the same
+// tick shares one read of the file.
+class ProcFile
+{
+public:
+    explicit ProcFile(const char *path) : path(path), buffer(4096) {}
+
+    ~ProcFile()
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+
+    // Returns an empty view if the file cannot be read.
+    std::string_view read(uint64_t tick)
+    {
+        if (tick == snapshotTick && snapshotTick != 0)
+        {
+            return std::string_view(buffer.data(), length);
+        }
+        if (fd < 0 && (fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        {
+            return {};
+        }
+
+        ssize_t n;
+        while ((n = pread(fd, buffer.data(), buffer.size(), 0)) == static_cast<ssize_t>(buffer.size()))
+        {
+            buffer.resize(buffer.size() * 2);
+        }
+        if (n < 0)
+        {
+            close(fd);
+            fd = -1;
+            return {};
+        }
+        length = static_cast<size_t>(n);
+        snapshotTick = tick;
+        reads++;
+        return std::string_view(buffer.data(), length);
+    }
+
+    uint64_t reads = 0;
+
+private:
+    const char *path;
+    int fd = -1;
+    std::vector<char> buffer;
+    size_t length = 0;
+    uint64_t snapshotTick = 0;
+};
+
+ProcFile procMeminfo("/proc/meminfo");
+ProcFile procStat("/proc/stat");
+ProcFile procNetDev("/proc/net/dev");
+ProcFile thermalZone0("/sys/class/thermal/thermal_zone0/temp");
+
+// Parses up to `count` blank-separated decimal numbers starting at `pos`.
+// Returns how many were parsed. No allocation.
+int scanNumbers(std::string_view data, size_t pos, long long *values, int count)
+{
+    int parsed = 0;
+    while (parsed < count)
+    {
+        while (pos < data.size() && (data[pos] == ' ' || data[pos] == '\t'))
+        {
+            pos++;
+        }
+        bool negative = pos < data.size() && data[pos] == '-';
+        if (negative)
+        {
+            pos++;
+        }
+        size_t digits = pos;
+        long long number = 0;
+        while (pos < data.size() && data[pos] >= '0' && data[pos] <= '9')
+        {
+            number = number * 10 + (data[pos] - '0');
+            pos++;
+        }
+        if (pos == digits)
+        {
+            break;
+        }
+        values[parsed++] = negative ? -number : number;
+    }
+    return parsed;
+}
+
+// Parses the decimal number following `key` at the start of a line, skipping
+// blanks. No allocation; returns false when the key is not present.
+bool scanProcValue(std::string_view data, std::string_view key, long long &value)
+{
+    size_t pos = 0;
+    while (pos < data.size())
+    {
+        if (data.compare(pos, key.size(), key) == 0)
+        {
+            return scanNumbers(data, pos + key.size(), &value, 1) == 1;
+        }
+        size_t newline = data.find('\n', pos);
+        if (newline == std::string_view::npos)
+        {
+            break;
+        }
+        pos = newline + 1;
+    }
+    return false;
+}
+
 std::string getMachineId()
 {
     std::ifstream file("/proc/sys/kernel/random/boot_id");
@@ -54,7 +240,9 @@ long long stringToLongLong(const std::string &str)
     return num;
 }
 
-float getUsedMemoryInGB()
+// Previous ifstream-based implementation, kept only as the baseline for
+// --bench-procfs.
+float getUsedMemoryInGBIfstream()
 {
     std::ifstream file("/proc/meminfo");
     std::string line;
@@ -104,148 +292,1466 @@ float getUsedMemoryInGB()
     }
 }
 
+float getUsedMemoryInGB()
+{
+    std::string_view meminfo = procMeminfo.read(currentTick);
+    long long totalMem = 0;
+    long long freeMem = 0;
+    long long buffers = 0;
+    long long cached = 0;
+
+    if (!scanProcValue(meminfo, "MemTotal:", totalMem))
+    {
+        return -1;
+    }
+    scanProcValue(meminfo, "MemFree:", freeMem);
+    scanProcValue(meminfo, "Buffers:", buffers);
+    scanProcValue(meminfo, "Cached:", cached);
+
+    // Calculate the used memory
+    long long usedMem = totalMem - (freeMem + buffers + cached);
+    // Convert from kB to GB
+    return usedMem / (1024.0 * 1024.0);
+}
+
 float getCpuTemperature()
 {
-    std::ifstream file("/sys/class/thermal/thermal_zone0/temp");
-    float temp;
-    if (file.is_open())
+    long long milliCelsius;
+    if (!scanProcValue(thermalZone0.read(currentTick), "", milliCelsius))
     {
-        file >> temp;
-        temp /= 1000;
-        file.close();
+        return -1;
     }
-    else
+    return milliCelsius / 1000.0f;
+}
+
+// Percentage of CPU time spent outside idle/iowait since the previous sample.
+float getCpuUsagePercent()
+{
+    static long long previousTotal = 0;
+    static long long previousIdle = 0;
+
+    long long fields[10] = {};
+    std::string_view stat = procStat.read(currentTick);
+    if (stat.compare(0, 4, "cpu ") != 0 || scanNumbers(stat, 4, fields, 10) < 4)
     {
-        temp = -1;
+        return -1;
+    }
+
+    long long total = 0;
+    for (int i = 0; i < 8; i++) // guest time is already counted in user/nice
+    {
+        total += fields[i];
+    }
+    long long idle = fields[3] + fields[4];
+
+    long long totalDelta = total - previousTotal;
+    long long idleDelta = idle - previousIdle;
+    previousTotal = total;
+    previousIdle = idle;
+
+    if (totalDelta <= 0)
+    {
+        return 0;
     }
-    return temp;
+    return 100.0f * (totalDelta - idleDelta) / totalDelta;
 }
 
-void publishInitialMessage(mqtt::client &client, const std::string &machineId)
+// Percentage of the root filesystem in use, as reported by df.
+float getDiskUsagePercent()
 {
-    nlohmann::json j;
-    j["machine_id"] = machineId;
+    struct statvfs fs;
+    if (statvfs("/", &fs) != 0)
+    {
+        return -1;
+    }
+    unsigned long long used = fs.f_blocks - fs.f_bfree;
+    unsigned long long available = used + fs.f_bavail;
+    if (available == 0)
+    {
+        return 0;
+    }
+    return 100.0f * used / available;
+}
 
-    for (const auto &sensor : sensors)
+// Received plus transmitted kB/s over all interfaces except loopback, since the
+// previous sample.
+float getNetworkThroughputKBps()
+{
+    static long long previousBytes = -1;
+    static std::chrono::steady_clock::time_point previousTime;
+
+    std::string_view netDev = procNetDev.read(currentTick);
+    if (netDev.empty())
     {
-        nlohmann::json sensor_info;
-        sensor_info["sensor_id"] = sensor.id;
-        sensor_info["data_type"] = sensor.type;
-        sensor_info["data_interval"] = sensor.interval;
-        j["sensors"].push_back(sensor_info);
+        return -1;
+    }
+
+    long long bytes = 0;
+    size_t pos = 0;
+    while (pos < netDev.size())
+    {
+        size_t newline = netDev.find('\n', pos);
+        std::string_view line = netDev.substr(pos, newline == std::string_view::npos ? std::string_view::npos : newline - pos);
+        size_t colon = line.find(':');
+        if (colon != std::string_view::npos)
+        {
+            std::string_view name = line.substr(0, colon);
+            name.remove_prefix(std::min(name.find_first_not_of(' '), name.size()));
+            long long counters[9];
+            if (name != "lo" && scanNumbers(line, colon + 1, counters, 9) == 9)
+            {
+                bytes += counters[0] + counters[8]; // rx_bytes, tx_bytes
+            }
+        }
+        if (newline == std::string_view::npos)
+        {
+            break;
+        }
+        pos = newline + 1;
     }
 
-    mqtt::message msg("/sensor_monitors", j.dump(), QOS, false);
-    client.publish(msg);
+    auto now = std::chrono::steady_clock::now();
+    float throughput = 0;
+    if (previousBytes >= 0 && now > previousTime)
+    {
+        double seconds = std::chrono::duration<double>(now - previousTime).count();
+        throughput = (bytes - previousBytes) / 1024.0 / seconds;
+    }
+    previousBytes = bytes;
+    previousTime = now;
+    return throughput;
+}
 
-    std::cout << "INITIAL -> message published - topic: "
-              << "/sensor_monitors"
-              << " - message: " << j.dump() << std::endl;
+// Every sensor the monitor knows how to read. Adding a sensor means writing its
+// read function and listing it here.
+struct SensorPlugin
+{
+    const char *id;
+    const char *type;
+    int defaultInterval; // ms
+    float (*read)();
+    bool rate = false; // reports the change since its previous read
+};
+
+const SensorPlugin sensorPlugins[] = {
+    {"cpu_temperature", "float", 1000, getCpuTemperature},
+    {"used_memory", "float", 1000, getUsedMemoryInGB},
+    {"cpu_usage", "float", 1000, getCpuUsagePercent, true},
+    {"disk_usage", "float", 10000, getDiskUsagePercent},
+    {"network_throughput", "float", 1000, getNetworkThroughputKBps, true},
+};
+
+const SensorPlugin *findSensorPlugin(const std::string &id)
+{
+    for (const auto &plugin : sensorPlugins)
+    {
+        if (id == plugin.id)
+        {
+            return &plugin;
+        }
+    }
+    return nullptr;
 }
 
-void readAndPublishSensorData(mqtt::client &client, const std::string &machineId, const SensorInfo &sensor)
+// Adds the sensors in "id[:interval_ms[:window_ms]],..."; ids without an
+// interval use the plugin's default. A window makes the sensor sample every
+// interval but publish only a min/max/mean/last/count summary per window.
+bool addSensors(const std::string &list)
 {
-    while (true)
+    std::stringstream ss(list);
+    std::string entry;
+    while (std::getline(ss, entry, ','))
     {
+        size_t colon = entry.find(':');
+        size_t windowColon = colon == std::string::npos ? std::string::npos : entry.find(':', colon + 1);
+        std::string id = entry.substr(0, colon);
+        const SensorPlugin *plugin = findSensorPlugin(id);
+        if (plugin == nullptr)
+        {
+            std::cerr << "Unknown sensor ID: " << id << std::endl;
+            return false;
+        }
+        int interval = colon == std::string::npos ? plugin->defaultInterval : std::stoi(entry.substr(colon + 1, windowColon - colon - 1));
+        int window = windowColon == std::string::npos ? 0 : std::stoi(entry.substr(windowColon + 1));
+        if (window > 0 && window < interval)
+        {
+            std::cerr << "Aggregation window of " << id << " is shorter than its interval" << std::endl;
+            return false;
+        }
+        sensors.emplace_back(plugin->id, plugin->type, interval, plugin->read, window);
+        sensors.back().rate = plugin->rate;
+    }
+    return true;
+}
 
-        if (messagesSent >= sensors.size() * 10)
+// Configures deadband publishing from "id:threshold[%]:heartbeat_ms,...". The
+// sensors must already be listed.
+bool addDeadbands(const std::string &list)
+{
+    std::stringstream ss(list);
+    std::string entry;
+    while (std::getline(ss, entry, ','))
+    {
+        size_t first = entry.find(':');
+        size_t second = first == std::string::npos ? std::string::npos : entry.find(':', first + 1);
+        if (second == std::string::npos)
         {
-            publishInitialMessage(client, machineId);
-            messagesSent = 0;
+            std::cerr << "Invalid deadband: " << entry << std::endl;
+            return false;
         }
-        else
+        std::string id = entry.substr(0, first);
+        std::string threshold = entry.substr(first + 1, second - first - 1);
+        int heartbeat = std::stoi(entry.substr(second + 1));
+
+        auto sensor = std::find_if(sensors.begin(), sensors.end(), [&](const SensorInfo &s)
+                                   { return s.id == id; });
+        if (sensor == sensors.end() || sensor->aggregateWindow > 0 || heartbeat < sensor->interval)
         {
+            std::cerr << "Deadband needs a non-aggregated sensor listed in --sensors and a heartbeat of at least its interval: "
+                      << entry << std::endl;
+            return false;
+        }
+        sensor->deadbandRelative = !threshold.empty() && threshold.back() == '%';
+        sensor->deadband = std::stof(sensor->deadbandRelative ? threshold.substr(0, threshold.size() - 1) : threshold);
+        sensor->heartbeatInterval = heartbeat;
+    }
+    return true;
+}
 
-            float sensorValue;
-            if (sensor.id == "cpu_temperature")
-            {
-                sensorValue = getCpuTemperature();
-            }
-            else if (sensor.id == "used_memory")
-            {
-                sensorValue = getUsedMemoryInGB();
-            }
-            else
-            {
-                std::cerr << "Unknown sensor ID: " << sensor.id << std::endl;
-                continue;
-            }
+// Whether a reading is worth publishing under the sensor's deadband.
+bool deadbandAllows(SensorInfo &sensor, float value)
+{
+    if (sensor.heartbeatInterval <= 0)
+    {
+        return true;
+    }
+    auto now = std::chrono::steady_clock::now();
+    float threshold = sensor.deadbandRelative ? std::fabs(sensor.lastPublishedValue) * sensor.deadband / 100 : sensor.deadband;
+    if (sensor.published && std::fabs(value - sensor.lastPublishedValue) <= threshold &&
+        now - sensor.lastPublishedAt < std::chrono::milliseconds(sensor.heartbeatInterval))
+    {
+        sensor.suppressed++;
+        return false;
+    }
+    sensor.published = true;
+    sensor.lastPublishedValue = value;
+    sensor.lastPublishedAt = now;
+    return true;
+}
 
-            // Get current time as ISO 8601 formatted string
-            auto now = std::chrono::system_clock::now();
-            std::time_t now_c = std::chrono::system_clock::to_time_t(now);
-            std::tm *now_tm = std::localtime(&now_c);
-            std::stringstream ss;
-            ss << std::put_time(now_tm, "%FT%TZ");
-            std::string timestamp = ss.str();
+// Per-sample cost of the ifstream path against the pread snapshot path, both
+// with a fresh read per sample and with several sensors sharing one tick.
+void benchmarkProcfs(int iterations)
+{
+    using Clock = std::chrono::steady_clock;
+    auto nsPerSample = [iterations](Clock::time_point start)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count() / iterations;
+    };
+    volatile float sink = 0;
 
-            // Construct JSON message
-            nlohmann::json j;
-            j["timestamp"] = timestamp;
-            j["value"] = sensorValue;
+    auto start = Clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        sink = sink + getUsedMemoryInGBIfstream();
+    }
+    std::cout << "ifstream /proc/meminfo: " << nsPerSample(start) << " ns/sample" << std::endl;
 
-            // Publish the JSON message to the appropriate topic
-            std::string topic = "/sensors/" + machineId + "/" + sensor.id;
-            mqtt::message msg(topic, j.dump(), QOS, false);
-            client.publish(msg);
+    start = Clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        currentTick++;
+        sink = sink + getUsedMemoryInGB();
+    }
+    std::cout << "pread snapshot, 1 sensor/tick: " << nsPerSample(start) << " ns/sample" << std::endl;
 
-            // Sleep for the interval specified for the sensor
-            std::cout << "message published - topic: " << topic << " - message: " << j.dump() << std::endl;
+    const int sensorsPerTick = 4;
+    start = Clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        if (i % sensorsPerTick == 0)
+        {
+            currentTick++;
+        }
+        sink = sink + getUsedMemoryInGB();
+    }
+    std::cout << "pread snapshot, " << sensorsPerTick << " sensors/tick: " << nsPerSample(start) << " ns/sample" << std::endl;
+}
 
-            messagesSent++;
-            std::this_thread::sleep_for(std::chrono::milliseconds(sensor.interval));
+// CRC-32 (IEEE 802.3, reflected polynomial 0xEDB88320) used to frame spool records.
+uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc = 0)
+{
+    static const auto table = []
+    {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+            {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
         }
+        return t;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+    {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
     }
+    return ~crc;
 }
 
-int main(int argc, char *argv[])
+// Disk-backed ring of messages that could not be published, kept in a
+// memory-mapped file so it survives a crash or restart of the monitor.
+//
+// The file is a 4 KiB header followed by `capacity` bytes of ring. head and
+// tail are ever-increasing logical byte offsets (position = offset % capacity).
+// Each record is an 8-byte aligned frame [size][crc32][topic length][topic]
+// [payload], where the CRC covers everything after the frame header. A record
+// never wraps: if it does not fit before the end of the ring, the remainder is
+// skipped (marked with SPOOL_PADDING when there is room for a frame header).
+// When full, either the oldest records are evicted or the new one is dropped.
+class Spool
 {
-    if (argc != 3)
+public:
+    enum class Eviction
     {
-        std::cerr << "Usage: " << argv[0] << " <machine_id> <interval (ms)>" << std::endl;
-        return EXIT_FAILURE;
+        dropOldest,
+        dropNewest
+    };
+
+    ~Spool() { close(); }
+
+    bool open(const std::string &path, uint64_t capacityBytes)
+    {
+        capacityBytes = (capacityBytes + 7) & ~uint64_t(7);
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat st;
+        size_t mappedSize = HEADER_SIZE + capacityBytes;
+        if (fstat(fd, &st) != 0 || (static_cast<size_t>(st.st_size) != mappedSize && ftruncate(fd, mappedSize) != 0))
+        {
+            close();
+            return false;
+        }
+        void *map = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            close();
+            return false;
+        }
+        base = static_cast<uint8_t *>(map);
+        size = mappedSize;
+        header = reinterpret_cast<Header *>(base);
+        ring = base + HEADER_SIZE;
+
+        if (header->magic != MAGIC || header->version != VERSION || header->capacity != capacityBytes ||
+            header->tail < header->head || header->tail - header->head > capacityBytes)
+        {
+            *header = Header{};
+            header->capacity = capacityBytes;
+        }
+        else
+        {
+            recover();
+        }
+        return true;
     }
 
-    std::string clientId = argv[1];
-    mqtt::client client(BROKER_ADDRESS, clientId);
+    void close()
+    {
+        if (base != nullptr)
+        {
+            msync(base, size, MS_SYNC);
+            munmap(base, size);
+            base = nullptr;
+            header = nullptr;
+        }
+        if (fd >= 0)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+    }
 
-    // Connect to the MQTT broker.
-    mqtt::connect_options connOpts;
-    connOpts.set_keep_alive_interval(20);
-    connOpts.set_clean_session(true);
+    bool isOpen() const { return header != nullptr; }
+    bool empty() const { return header == nullptr || header->records == 0; }
+    uint64_t records() const { return header != nullptr ? header->records : 0; }
+    uint64_t usedBytes() const { return header != nullptr ? header->tail - header->head : 0; }
+    uint64_t evicted() const { return header != nullptr ? header->evicted : 0; }
+    uint64_t corrupted() const { return header != nullptr ? header->corrupted : 0; }
 
-    try
+    bool push(const std::string &topic, const uint8_t *payload, size_t payloadSize)
     {
-        client.connect(connOpts);
+        uint64_t capacity = header->capacity;
+        uint64_t body = 2 + topic.size() + payloadSize;
+        uint64_t frame = align(FRAME_HEADER + body);
+        if (frame > capacity / 2 || topic.size() > UINT16_MAX)
+        {
+            header->evicted++;
+            return false;
+        }
+
+        uint64_t position = header->tail % capacity;
+        uint64_t padding = capacity - position < frame ? capacity - position : 0;
+        while (header->tail + padding + frame - header->head > capacity)
+        {
+            if (eviction == Eviction::dropNewest || header->records == 0)
+            {
+                header->evicted++;
+                return false;
+            }
+            popFront();
+            header->evicted++;
+        }
+
+        if (padding > 0)
+        {
+            if (padding >= FRAME_HEADER)
+            {
+                store32(ring + position, SPOOL_PADDING);
+            }
+            position = 0;
+        }
+        uint8_t *record = ring + position;
+        uint16_t topicSize = static_cast<uint16_t>(topic.size());
+        std::memcpy(record + FRAME_HEADER, &topicSize, 2);
+        std::memcpy(record + FRAME_HEADER + 2, topic.data(), topic.size());
+        std::memcpy(record + FRAME_HEADER + 2 + topic.size(), payload, payloadSize);
+        store32(record, static_cast<uint32_t>(body));
+        store32(record + 4, crc32(record + FRAME_HEADER, body));
+
+        // published only once the record is complete
+        header->tail += padding + frame;
+        header->records++;
+        return true;
     }
-    catch (mqtt::exception &e)
+
+    // Copies the oldest record without removing it. A record failing its CRC
+    // check means the ring can no longer be walked, so it is discarded whole.
+    bool front(std::string &topic, std::string &payload)
     {
-        std::cerr << "Error: " << e.what() << std::endl;
-        return EXIT_FAILURE;
+        while (!empty())
+        {
+            uint64_t position = skipPadding(header->head) % header->capacity;
+            const uint8_t *record = ring + position;
+            uint32_t body = load32(record);
+            // same bound as recover(): a corrupt length must not read past the ring
+            if (body >= 2 && position + FRAME_HEADER + body <= header->capacity &&
+                crc32(record + FRAME_HEADER, body) == load32(record + 4))
+            {
+                uint16_t topicSize;
+                std::memcpy(&topicSize, record + FRAME_HEADER, 2);
+                if (2u + topicSize <= body)
+                {
+                    topic.assign(reinterpret_cast<const char *>(record + FRAME_HEADER + 2), topicSize);
+                    payload.assign(reinterpret_cast<const char *>(record + FRAME_HEADER + 2 + topicSize), body - 2 - topicSize);
+                    return true;
+                }
+            }
+            header->corrupted += header->records;
+            header->head = header->tail;
+            header->records = 0;
+        }
+        return false;
     }
-    std::clog << "connected to the broker" << std::endl;
 
-    std::string machineId = argv[1];
-    // std::string machineId = getMachineId();
+    void pop()
+    {
+        if (!empty())
+        {
+            popFront();
+        }
+    }
 
+    // Asks the kernel to start writing dirty pages back to disk.
+    void flush()
+    {
+        if (base != nullptr)
+        {
+            msync(base, size, MS_ASYNC);
+        }
+    }
 
+    Eviction eviction = Eviction::dropOldest;
 
-    sensors.emplace_back("cpu_temperature", "float", std::stoi(argv[2]));
-    sensors.emplace_back("used_memory", "float", std::stoi(argv[2]));
+private:
+    static constexpr uint32_t MAGIC = 0x4C4F5053; // "SPOL"
+    static constexpr uint32_t VERSION = 1;
+    static constexpr size_t HEADER_SIZE = 4096;
+    static constexpr uint64_t FRAME_HEADER = 8;
+    static constexpr uint32_t SPOOL_PADDING = 0xFFFFFFFF;
 
-    // publish initial message
-    publishInitialMessage(client, machineId);
+    struct Header
+    {
+        uint32_t magic = MAGIC;
+        uint32_t version = VERSION;
+        uint64_t capacity = 0;
+        uint64_t head = 0;
+        uint64_t tail = 0;
+        uint64_t records = 0;
+        uint64_t evicted = 0;
+        uint64_t corrupted = 0;
+    };
 
-    for (const auto &sensor : sensors)
+    static uint64_t align(uint64_t n) { return (n + 7) & ~uint64_t(7); }
+
+    static uint32_t load32(const uint8_t *p)
+    {
+        uint32_t v;
+        std::memcpy(&v, p, 4);
+        return v;
+    }
+
+    static void store32(uint8_t *p, uint32_t v) { std::memcpy(p, &v, 4); }
+
+    // Moves a logical offset past the unused end of the ring, if any.
+    uint64_t skipPadding(uint64_t offset) const
+    {
+        uint64_t position = offset % header->capacity;
+        uint64_t remaining = header->capacity - position;
+        if (remaining < FRAME_HEADER || load32(ring + position) == SPOOL_PADDING)
+        {
+            return offset + remaining;
+        }
+        return offset;
+    }
+
+    void popFront()
     {
-        std::thread(readAndPublishSensorData, std::ref(client), machineId, sensor).detach();
+        uint64_t offset = skipPadding(header->head);
+        header->head = offset + align(FRAME_HEADER + load32(ring + offset % header->capacity));
+        header->records--;
+        if (header->records == 0)
+        {
+            header->head = header->tail;
+        }
     }
 
-    // The main thread can do other tasks or just wait
-    while (true)
+    // Walks the records left by a previous run and cuts the ring at the first
+    // one that is torn or fails its CRC.
+    void recover()
     {
-        std::this_thread::sleep_for(std::chrono::milliseconds(std::stoi(argv[2])));
+        uint64_t offset = header->head;
+        uint64_t valid = 0;
+        while (offset < header->tail)
+        {
+            offset = skipPadding(offset);
+            if (offset >= header->tail)
+            {
+                break;
+            }
+            const uint8_t *record = ring + offset % header->capacity;
+            uint32_t body = load32(record);
+            uint64_t frame = align(FRAME_HEADER + body);
+            if (body < 2 || offset % header->capacity + frame > header->capacity || offset + frame > header->tail ||
+                crc32(record + FRAME_HEADER, body) != load32(record + 4))
+            {
+                break;
+            }
+            offset += frame;
+            valid++;
+        }
+        if (valid != header->records || offset != header->tail)
+        {
+            header->corrupted += header->records > valid ? header->records - valid : 0;
+            header->tail = offset;
+            header->records = valid;
+        }
     }
 
+    int fd = -1;
+    uint8_t *base = nullptr;
+    size_t size = 0;
+    Header *header = nullptr;
+    uint8_t *ring = nullptr;
+};
+
+Spool spool;
+std::string spoolPath;            // empty: spool disabled, failed publishes are dropped
+uint64_t spoolSizeBytes = 64ull << 20;
+double spoolDrainRate = 200;      // spooled messages replayed per second once reconnected
+int maxInFlight = 32;              // unacknowledged QoS 1 publishes allowed at once
+mqtt::connect_options connectOptions;
+
+// Lock-free multi-producer/single-consumer queue (Vyukov's intrusive list with
+// a stub node). push() is wait-free; pop() may briefly see an empty queue while
+// a producer is between its two stores, which the consumer just retries later.
+template <typename T>
+class MpscQueue
+{
+public:
+    MpscQueue() : head(new Node), tail(head.load()) {}
+
+    ~MpscQueue()
+    {
+        T discarded;
+        while (pop(discarded))
+        {
+        }
+        delete tail;
+    }
+
+    void push(T value)
+    {
+        Node *node = new Node;
+        node->value = std::move(value);
+        Node *previous = head.exchange(node, std::memory_order_acq_rel);
+        previous->next.store(node, std::memory_order_release);
+    }
+
+    bool pop(T &value)
+    {
+        Node *next = tail->next.load(std::memory_order_acquire);
+        if (next == nullptr)
+        {
+            return false;
+        }
+        value = std::move(next->value);
+        delete tail;
+        tail = next;
+        return true;
+    }
+
+private:
+    struct Node
+    {
+        std::atomic<Node *> next{nullptr};
+        T value;
+    };
+
+    std::atomic<Node *> head;
+    Node *tail;
+};
+
+struct OutgoingMessage
+{
+    std::string topic;
+    std::string payload;
+};
+
+// Owns all network I/O of the monitor. Sensor tasks submit() into an MPSC
+// queue and return immediately; the publisher thread sends over the
+// async_client with at most maxInFlight unacknowledged messages, and
+// completions come back through a per-message action listener. Messages that
+// cannot be sent (disconnected, window full, delivery failed) go to the spool,
+// which this thread alone reads and writes, and are replayed in order at
+// spoolDrainRate messages per second.
+class Publisher
+{
+public:
+    explicit Publisher(mqtt::async_client &client) : client(client) {}
+
+    ~Publisher() { stop(); }
+
+    void start(int maxInFlight)
+    {
+        this->maxInFlight = std::max(1, maxInFlight);
+        stopping = false;
+        thread = std::thread(&Publisher::run, this);
+    }
+
+    void stop()
+    {
+        if (thread.joinable())
+        {
+            stopping = true;
+            wake();
+            thread.join();
+        }
+    }
+
+    void submit(std::string topic, std::string payload)
+    {
+        submitted.fetch_add(1, std::memory_order_relaxed);
+        outgoing.push(OutgoingMessage{std::move(topic), std::move(payload)});
+        wake();
+    }
+
+    // Announcements are never spooled; the latest one is re-sent on every
+    // (re)connection because the processor ignores unannounced machines, and
+    // a failed one is simply marked pending again.
+    void announce(std::string payload)
+    {
+        {
+            std::lock_guard<std::mutex> lock(announcementMutex);
+            announcement = std::move(payload);
+        }
+        announcementPending = true;
+        wake();
+    }
+
+    void printStats() const
+    {
+        std::cout << "PUBLISHER -> submitted: " << submitted << " - acked: " << acked
+                  << " - failed: " << failed << " - in flight: " << inFlight << "/" << maxInFlight
+                  << " - spooled: " << spooled << " (pending " << spoolPending << ", evicted " << spoolEvicted
+                  << ", corrupted " << spoolCorrupted << ") - dropped: " << dropped << std::endl;
+    }
+
+private:
+    // Completion of one publish; deletes itself after reporting back.
+    class Delivery : public mqtt::iaction_listener
+    {
+    public:
+        Delivery(Publisher &publisher, OutgoingMessage message, bool announcement)
+            : publisher(publisher), message(std::move(message)), announcement(announcement) {}
+
+        void on_success(const mqtt::token &) override
+        {
+            publisher.acked.fetch_add(1, std::memory_order_relaxed);
+            publisher.complete();
+            delete this;
+        }
+
+        void on_failure(const mqtt::token &) override
+        {
+            publisher.failed.fetch_add(1, std::memory_order_relaxed);
+            if (announcement)
+            {
+                publisher.announcementPending = true;
+            }
+            else
+            {
+                publisher.retries.push(std::move(message));
+            }
+            publisher.complete();
+            delete this;
+        }
+
+    private:
+        Publisher &publisher;
+        OutgoingMessage message;
+        bool announcement;
+    };
+
+    void complete()
+    {
+        inFlight.fetch_sub(1, std::memory_order_acq_rel);
+        wake();
+    }
+
+    void wake()
+    {
+        if (sleeping.exchange(false, std::memory_order_acq_rel))
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            wakeCv.notify_one();
+        }
+    }
+
+    bool windowOpen() const { return inFlight.load(std::memory_order_acquire) < maxInFlight; }
+
+    bool send(OutgoingMessage message, bool announcement = false)
+    {
+        inFlight.fetch_add(1, std::memory_order_acq_rel);
+        std::string topic = message.topic;
+        auto msg = mqtt::make_message(topic, message.payload, QOS, false);
+        Delivery *delivery = new Delivery(*this, std::move(message), announcement);
+        try
+        {
+            client.publish(msg, nullptr, *delivery);
+            return true;
+        }
+        catch (mqtt::exception &e)
+        {
+            std::cerr << "Publish failed on " << topic << ": " << e.what() << std::endl;
+            inFlight.fetch_sub(1, std::memory_order_acq_rel);
+            failed.fetch_add(1, std::memory_order_relaxed);
+            if (announcement)
+            {
+                announcementPending = true;
+            }
+            else
+            {
+                park(std::move(msg));
+            }
+            delete delivery;
+            return false;
+        }
+    }
+
+    void park(mqtt::const_message_ptr msg)
+    {
+        park(OutgoingMessage{msg->get_topic(), msg->get_payload()});
+    }
+
+    void park(const OutgoingMessage &message)
+    {
+        if (spool.isOpen() && spool.push(message.topic, reinterpret_cast<const uint8_t *>(message.payload.data()), message.payload.size()))
+        {
+            spooled.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        updateSpoolStats();
+    }
+
+    void updateSpoolStats()
+    {
+        spoolPending = spool.records();
+        spoolEvicted = spool.evicted();
+        spoolCorrupted = spool.corrupted();
+    }
+
+    // Reconnects with exponential backoff (1 s up to 30 s).
+    bool ensureConnected()
+    {
+        if (client.is_connected())
+        {
+            return true;
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now < nextReconnect)
+        {
+            return false;
+        }
+        try
+        {
+            client.connect(connectOptions)->wait();
+            reconnectBackoffMs = 0;
+            std::clog << "connected to the broker" << std::endl;
+            return true;
+        }
+        catch (mqtt::exception &e)
+        {
+            reconnectBackoffMs = std::min(std::max(reconnectBackoffMs * 2, 1000), 30000);
+            nextReconnect = now + std::chrono::milliseconds(reconnectBackoffMs);
+            std::cerr << "Broker unreachable: " << e.what() << " - retrying in " << reconnectBackoffMs << " ms" << std::endl;
+            return false;
+        }
+    }
+
+    void drainSpool()
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (spool.empty())
+        {
+            drainRefill = now;
+            drainTokens = 0;
+            return;
+        }
+
+        double elapsed = std::chrono::duration<double>(now - drainRefill).count();
+        drainRefill = now;
+        drainTokens = std::min(drainTokens + elapsed * spoolDrainRate, std::max(spoolDrainRate, 1.0));
+
+        OutgoingMessage message;
+        uint64_t replayed = 0;
+        while (drainTokens >= 1 && windowOpen() && spool.front(message.topic, message.payload))
+        {
+            spool.pop();
+            drainTokens -= 1;
+            if (!send(std::move(message)))
+            {
+                break;
+            }
+            replayed++;
+        }
+        spool.flush();
+        updateSpoolStats();
+
+        if (replayed > 0)
+        {
+            std::cout << "SPOOL -> replayed: " << replayed << " - pending: " << spool.records()
+                      << " (" << spool.usedBytes() << " bytes)" << std::endl;
+        }
+    }
+
+    void run()
+    {
+        bool holding = false;
+        OutgoingMessage message;
+        while (!stopping)
+        {
+            bool connected = ensureConnected();
+            if (connected && !wasConnected)
+            {
+                announcementPending = true;
+            }
+            wasConnected = connected;
+
+            // the announcement goes ahead of the spool, but still waits for the window
+            if (connected && windowOpen() && announcementPending.exchange(false))
+            {
+                std::lock_guard<std::mutex> lock(announcementMutex);
+                if (!announcement.empty())
+                {
+                    send(OutgoingMessage{"/sensor_monitors", announcement}, true);
+                }
+            }
+
+            // failed deliveries are retried after what is already spooled
+            OutgoingMessage retry;
+            while (retries.pop(retry))
+            {
+                park(retry);
+            }
+
+            if (connected)
+            {
+                drainSpool();
+            }
+
+            // New messages go straight out only while nothing older is waiting
+            // in the spool; without a spool they wait here for the window.
+            while (holding || outgoing.pop(message))
+            {
+                holding = false;
+                if (connected && spool.empty() && windowOpen())
+                {
+                    send(std::move(message));
+                }
+                else if (spool.isOpen() || !connected)
+                {
+                    park(message);
+                }
+                else
+                {
+                    holding = true;
+                    break;
+                }
+            }
+
+            sleeping.store(true, std::memory_order_release);
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            wakeCv.wait_for(lock, std::chrono::milliseconds(connected ? 50 : 200),
+                            [this]
+                            { return !sleeping.load(std::memory_order_acquire) || stopping; });
+            sleeping.store(false, std::memory_order_release);
+        }
+    }
+
+    mqtt::async_client &client;
+    int maxInFlight = 1;
+    std::thread thread;
+    std::atomic<bool> stopping{false};
+
+    MpscQueue<OutgoingMessage> outgoing;
+    MpscQueue<OutgoingMessage> retries;
+
+    std::mutex announcementMutex;
+    std::string announcement;
+    std::atomic<bool> announcementPending{false};
+
+    std::atomic<bool> sleeping{false};
+    std::mutex wakeMutex;
+    std::condition_variable wakeCv;
+
+    bool wasConnected = false;
+    std::chrono::steady_clock::time_point nextReconnect;
+    int reconnectBackoffMs = 0;
+    double drainTokens = 0;
+    std::chrono::steady_clock::time_point drainRefill;
+
+    std::atomic<int> inFlight{0};
+    std::atomic<uint64_t> submitted{0};
+    std::atomic<uint64_t> acked{0};
+    std::atomic<uint64_t> failed{0};
+    std::atomic<uint64_t> spooled{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> spoolPending{0};
+    std::atomic<uint64_t> spoolEvicted{0};
+    std::atomic<uint64_t> spoolCorrupted{0};
+};
+
+void publishInitialMessage(Publisher &publisher, const std::string &machineId)
+{
+    nlohmann::json j;
+    j["machine_id"] = machineId;
+    j["payload_format"] = payloadFormat;
+
+    for (const auto &sensor : sensors)
+    {
+        nlohmann::json sensor_info;
+        sensor_info["sensor_id"] = sensor.id;
+        sensor_info["data_type"] = sensor.type;
+        if (sensor.aggregateWindow > 0)
+        {
+            // the processor expects one message per window
+            sensor_info["data_interval"] = sensor.aggregateWindow;
+            sensor_info["sample_interval"] = sensor.interval;
+            sensor_info["aggregate"] = true;
+        }
+        else
+        {
+            sensor_info["data_interval"] = sensor.interval;
+        }
+        if (sensor.heartbeatInterval > 0)
+        {
+            // silence up to this long is normal for a deadband sensor
+            sensor_info["heartbeat_interval"] = sensor.heartbeatInterval;
+        }
+        j["sensors"].push_back(sensor_info);
+    }
+
+    publisher.announce(j.dump());
+
+    std::cout << "INITIAL -> message published - topic: "
+              << "/sensor_monitors"
+              << " - message: " << j.dump() << std::endl;
+}
+
+// Formats UTC ISO 8601 timestamps. The "YYYY-MM-DDTHH:MM:SS" prefix is only
+// re-rendered when the second changes; within the same second only the
+// millisecond suffix is written.
+class TimestampFormatter
+{
+public:
+    std::string format(std::chrono::system_clock::time_point time)
+    {
+        int64_t epochMs = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+        int64_t second = epochMs / 1000;
+        if (second != cachedSecond)
+        {
+            std::time_t seconds = static_cast<std::time_t>(second);
+            std::tm utc;
+            gmtime_r(&seconds, &utc);
+            std::strftime(prefix, sizeof(prefix), "%Y-%m-%dT%H:%M:%S", &utc);
+            cachedSecond = second;
+        }
+
+        std::string timestamp(prefix, 19);
+        if (millisecondPrecision)
+        {
+            int millis = static_cast<int>(epochMs % 1000);
+            char suffix[5] = {'.', char('0' + millis / 100), char('0' + millis / 10 % 10), char('0' + millis % 10), 'Z'};
+            timestamp.append(suffix, 5);
+        }
+        else
+        {
+            timestamp += 'Z';
+        }
+        return timestamp;
+    }
+
+    bool millisecondPrecision = false;
+
+private:
+    int64_t cachedSecond = -1;
+    char prefix[32] = {};
+};
+
+TimestampFormatter timestampFormatter;
+
+void publishBatch(Publisher &publisher, const std::string &machineId)
+{
+    if (pendingBatch.empty())
+    {
+        return;
+    }
+
+    std::string topic = "/sensor_batches/" + machineId;
+    std::vector<std::uint8_t> payload = encodePayload(pendingBatch);
+    publisher.submit(topic, std::string(payload.begin(), payload.end()));
+
+    std::cout << "batch published - topic: " << topic << " - readings: " << pendingBatch.size() << std::endl;
+
+    pendingBatch = nlohmann::json::array();
+}
+
+// Publishes the pending batch if it is full or its oldest reading is too old.
+void flushBatchIfDue(Publisher &publisher, const std::string &machineId)
+{
+    if (!pendingBatch.empty() &&
+        (pendingBatch.size() >= batchSize ||
+         std::chrono::steady_clock::now() - pendingBatchStart >= std::chrono::milliseconds(batchMaxAgeMs)))
+    {
+        publishBatch(publisher, machineId);
+    }
+}
+
+// Publishes the summary of the sensor's finished window to
+// /sensors/<machine_id>/<sensor_id>/agg, stamped with the window start.
+void publishAggregate(Publisher &publisher, const std::string &machineId, SensorInfo &sensor, std::chrono::system_clock::time_point now)
+{
+    const SensorInfo::Aggregate &aggregate = sensor.aggregate;
+    std::chrono::system_clock::time_point windowStart(std::chrono::milliseconds(aggregate.window * sensor.aggregateWindow));
+
+    nlohmann::json j;
+    j["timestamp"] = timestampFormatter.format(windowStart);
+    j["window_ms"] = sensor.aggregateWindow;
+    j["count"] = aggregate.count;
+    j["min"] = aggregate.min;
+    j["max"] = aggregate.max;
+    j["mean"] = aggregate.sum / aggregate.count;
+    j["last"] = aggregate.last;
+    j["run"] = runId;
+    j["seq"] = ++sensor.seq;
+    j["sent_ns"] = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+
+    messagesSent++;
+
+    std::string topic = "/sensors/" + machineId + "/" + sensor.id + "/agg";
+    std::vector<std::uint8_t> payload = encodePayload(j);
+    publisher.submit(topic, std::string(payload.begin(), payload.end()));
+
+    std::cout << "aggregate published - topic: " << topic << " - message: " << j.dump() << std::endl;
+}
+
+// Folds one sample into the sensor's tumbling window, publishing the previous
+// window first if this sample starts a new one.
+void aggregateSample(Publisher &publisher, const std::string &machineId, SensorInfo &sensor, float value, std::chrono::system_clock::time_point now)
+{
+    int64_t epochMs = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
+    int64_t window = epochMs / sensor.aggregateWindow;
+    SensorInfo::Aggregate &aggregate = sensor.aggregate;
+
+    if (aggregate.count > 0 && window != aggregate.window)
+    {
+        publishAggregate(publisher, machineId, sensor, now);
+        aggregate.count = 0;
+    }
+    if (aggregate.count == 0)
+    {
+        aggregate.window = window;
+        aggregate.min = aggregate.max = value;
+        aggregate.sum = 0;
+    }
+    aggregate.count++;
+    aggregate.min = std::min(aggregate.min, value);
+    aggregate.max = std::max(aggregate.max, value);
+    aggregate.sum += value;
+    aggregate.last = value;
+}
+
+void readAndPublishSensorData(Publisher &publisher, const std::string &machineId, SensorInfo &sensor)
+{
+    float sensorValue = sensor.read();
+
+    auto now = std::chrono::system_clock::now();
+    if (sensor.aggregateWindow > 0)
+    {
+        aggregateSample(publisher, machineId, sensor, sensorValue, now);
+        return;
+    }
+    if (!deadbandAllows(sensor, sensorValue))
+    {
+        // still counts toward the periodic re-announcement
+        messagesSent++;
+        return;
+    }
+
+    // Get current time as ISO 8601 formatted string (UTC)
+    std::string timestamp = timestampFormatter.format(now);
+
+    // Construct JSON message
+    nlohmann::json j;
+    j["timestamp"] = timestamp;
+    j["value"] = sensorValue;
+    j["run"] = runId;
+    j["seq"] = ++sensor.seq;
+    // Send time in ns since the epoch, used by the processor to measure the
+    // broker leg. A monotonic clock would be meaningless on another host.
+    j["sent_ns"] = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+
+    messagesSent++;
+
+    if (batchSize > 0)
+    {
+        if (pendingBatch.empty())
+        {
+            pendingBatchStart = std::chrono::steady_clock::now();
+        }
+        j["sensor_id"] = sensor.id;
+        pendingBatch.push_back(std::move(j));
+        return;
+    }
+
+    // Publish the JSON message to the appropriate topic
+    std::string topic = "/sensors/" + machineId + "/" + sensor.id;
+    std::vector<std::uint8_t> payload = encodePayload(j);
+    publisher.submit(topic, std::string(payload.begin(), payload.end()));
+
+    std::cout << "message published - topic: " << topic << " - message: " << j.dump() << std::endl;
+}
+
+// Lateness of each tick relative to its absolute deadline (mean, jitter and max).
+struct TickStats
+{
+    uint64_t ticks = 0;
+    uint64_t missed = 0;
+    double meanLatenessUs = 0;
+    double m2 = 0;
+    int64_t maxLatenessUs = 0;
+
+    void record(int64_t latenessUs)
+    {
+        ticks++;
+        double delta = latenessUs - meanLatenessUs;
+        meanLatenessUs += delta / ticks;
+        m2 += delta * (latenessUs - meanLatenessUs);
+        maxLatenessUs = std::max(maxLatenessUs, latenessUs);
+    }
+
+    double jitterUs() const { return ticks > 1 ? std::sqrt(m2 / ticks) : 0.0; }
+};
+
+// Runs every sensor from a single thread using a min-heap of absolute deadlines.
+// The next deadline is always the previous one plus the period (no drift), and
+// sensors due at the same instant are handed over together in one tick.
+class Scheduler
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // A delayed sensor first fires one period after the start instead of at
+    // once, e.g. so a rate sensor's first delta covers a full period.
+    void add(size_t sensorIndex, std::chrono::milliseconds period, bool delayFirst = false)
+    {
+        if (periods.size() <= sensorIndex)
+        {
+            periods.resize(sensorIndex + 1);
+            stats.resize(sensorIndex + 1);
+        }
+        periods[sensorIndex] = std::max(period, std::chrono::milliseconds(1));
+        heap.push(Entry{delayFirst ? start + periods[sensorIndex] : start, sensorIndex});
+    }
+
+    void run(const std::function<void(const std::vector<size_t> &)> &onTick)
+    {
+        std::vector<size_t> due;
+        while (!heap.empty())
+        {
+            Clock::time_point deadline = heap.top().deadline;
+            std::this_thread::sleep_until(deadline);
+            Clock::time_point now = Clock::now();
+
+            due.clear();
+            while (!heap.empty() && heap.top().deadline == deadline)
+            {
+                due.push_back(heap.top().index);
+                heap.pop();
+            }
+
+            for (size_t index : due)
+            {
+                stats[index].record(std::chrono::duration_cast<std::chrono::microseconds>(now - deadline).count());
+            }
+
+            onTick(due);
+
+            now = Clock::now();
+            for (size_t index : due)
+            {
+                Clock::time_point next = deadline + periods[index];
+                if (next <= now)
+                {
+                    // More than a period behind: skip the missed ticks but stay on the grid
+                    auto behind = (now - next) / periods[index] + 1;
+                    stats[index].missed += behind;
+                    next += behind * periods[index];
+                }
+                heap.push(Entry{next, index});
+            }
+        }
+    }
+
+    const TickStats &getStats(size_t sensorIndex) const { return stats[sensorIndex]; }
+
+private:
+    struct Entry
+    {
+        Clock::time_point deadline;
+        size_t index;
+        bool operator>(const Entry &other) const { return deadline > other.deadline; }
+    };
+
+    Clock::time_point start = Clock::now();
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+    std::vector<std::chrono::milliseconds> periods;
+    std::vector<TickStats> stats;
+};
+
+void printSchedulerStats(const Scheduler &scheduler)
+{
+    for (size_t i = 0; i < sensors.size(); i++)
+    {
+        const TickStats &stats = scheduler.getStats(i);
+        std::cout << "SCHEDULER -> sensor: " << sensors[i].id
+                  << " - ticks: " << stats.ticks
+                  << " - missed: " << stats.missed
+                  << " - lateness mean/max (us): " << static_cast<int64_t>(stats.meanLatenessUs) << "/" << stats.maxLatenessUs
+                  << " - jitter (us): " << static_cast<int64_t>(stats.jitterUs())
+                  << " - suppressed: " << sensors[i].suppressed << std::endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc == 2 && std::string(argv[1]) == "--bench-procfs")
+    {
+        benchmarkProcfs(100000);
+        return EXIT_SUCCESS;
+    }
+
+    bool validArgs = argc >= 3;
+    std::string deadbands;
+    for (int i = 3; validArgs && i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg.rfind("--sensors=", 0) == 0)
+        {
+            validArgs = addSensors(arg.substr(10));
+        }
+        else if (arg.rfind("--deadband=", 0) == 0)
+        {
+            deadbands = arg.substr(11);
+        }
+        else if (arg.rfind("--batch=", 0) == 0)
+        {
+            batchSize = std::stoi(arg.substr(8));
+        }
+        else if (arg.rfind("--batch-ms=", 0) == 0)
+        {
+            batchMaxAgeMs = std::stoi(arg.substr(11));
+        }
+        else if (arg == "--format=json" || arg == "--format=cbor" || arg == "--format=msgpack")
+        {
+            payloadFormat = arg.substr(9);
+        }
+        else if (arg == "--timestamp-ms")
+        {
+            timestampFormatter.millisecondPrecision = true;
+        }
+        else if (arg.rfind("--max-inflight=", 0) == 0)
+        {
+            maxInFlight = std::stoi(arg.substr(15));
+        }
+        else if (arg.rfind("--spool=", 0) == 0)
+        {
+            spoolPath = arg.substr(8);
+        }
+        else if (arg.rfind("--spool-mb=", 0) == 0)
+        {
+            spoolSizeBytes = std::max(1, std::stoi(arg.substr(11))) * (1ull << 20);
+        }
+        else if (arg.rfind("--spool-rate=", 0) == 0)
+        {
+            spoolDrainRate = std::max(1.0, std::stod(arg.substr(13)));
+        }
+        else if (arg == "--spool-evict=oldest" || arg == "--spool-evict=newest")
+        {
+            spool.eviction = arg == "--spool-evict=oldest" ? Spool::Eviction::dropOldest : Spool::Eviction::dropNewest;
+        }
+        else
+        {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            validArgs = false;
+        }
+    }
+
+    if (!validArgs)
+    {
+        std::cerr << "Usage: " << argv[0] << " <machine_id> <interval (ms)> [--sensors=<id>[:<interval>[:<window>]],...]"
+                  << " [--deadband=<id>:<threshold>[%]:<heartbeat (ms)>,...]"
+                  << " [--batch=<readings>] [--batch-ms=<ms>] [--format=json|cbor|msgpack]"
+                  << " [--timestamp-ms] [--max-inflight=<n>] [--spool=<path>] [--spool-mb=<MB>] [--spool-rate=<msgs/s>]"
+                  << " [--spool-evict=oldest|newest]" << std::endl;
+        std::cerr << "       " << argv[0] << " --bench-procfs" << std::endl;
+        std::cerr << "Sensors:";
+        for (const auto &plugin : sensorPlugins)
+        {
+            std::cerr << " " << plugin.id;
+        }
+        std::cerr << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (sensors.empty())
+    {
+        sensors.emplace_back("cpu_temperature", "float", std::stoi(argv[2]), getCpuTemperature);
+        sensors.emplace_back("used_memory", "float", std::stoi(argv[2]), getUsedMemoryInGB);
+    }
+    if (!deadbands.empty() && !addDeadbands(deadbands))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (!spoolPath.empty())
+    {
+        if (!spool.open(spoolPath, spoolSizeBytes))
+        {
+            std::cerr << "Error: cannot open spool " << spoolPath << ": " << std::strerror(errno) << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::clog << "spool " << spoolPath << ": " << spool.records() << " pending messages" << std::endl;
+    }
+
+    std::string clientId = argv[1];
+    mqtt::async_client client(BROKER_ADDRESS, clientId);
+
+    // Connect to the MQTT broker.
+    connectOptions.set_keep_alive_interval(20);
+    connectOptions.set_clean_session(true);
+
+    try
+    {
+        client.connect(connectOptions)->wait();
+        std::clog << "connected to the broker" << std::endl;
+    }
+    catch (mqtt::exception &e)
+    {
+        if (!spool.isOpen())
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        // keep sampling into the spool; the publisher retries the connection
+        std::cerr << "Broker unreachable, spooling: " << e.what() << std::endl;
+    }
+
+    Publisher publisher(client);
+    publisher.start(maxInFlight);
+
+    std::string machineId = argv[1];
+    // std::string machineId = getMachineId();
+
+    // publish initial message
+    publishInitialMessage(publisher, machineId);
+
+    // Rate sensors are primed here, as the scheduler starts, and first fire one
+    // interval later, so their first value is the change over one interval
+    // rather than since boot or since a moment ago.
+    Scheduler scheduler;
+    for (size_t i = 0; i < sensors.size(); i++)
+    {
+        if (sensors[i].rate)
+        {
+            sensors[i].read();
+        }
+        scheduler.add(i, std::chrono::milliseconds(sensors[i].interval), sensors[i].rate);
+    }
+
+    // The main thread runs every sensor task from the scheduler
+    scheduler.run([&](const std::vector<size_t> &due)
+                  {
+                      currentTick++;
+                      for (size_t index : due)
+                      {
+                          readAndPublishSensorData(publisher, machineId, sensors[index]);
+                      }
+                      if (batchSize > 0)
+                      {
+                          flushBatchIfDue(publisher, machineId);
+                      }
+
+                      if (messagesSent >= static_cast<int>(sensors.size()) * 10)
+                      {
+                          publishInitialMessage(publisher, machineId);
+                          printSchedulerStats(scheduler);
+                          publisher.printStats();
+                          messagesSent = 0;
+                      } });
+
+    publisher.stop();
     return EXIT_SUCCESS;
 }
\ No newline at end of file